@@ -3,7 +3,23 @@
  *
  * This module collects various system statistics and exposes them through /proc filesystem.
  * It uses a kernel thread for continuous monitoring and provides a control interface
- * for enabling/disabling monitoring.
+ * for enabling/disabling monitoring, tuning the (optionally adaptive) sampling
+ * interval, per-thread statistics, and threshold alerts, whose firing and clearing
+ * events are delivered through a blocking-readable event file. The task walk also
+ * rolls resource usage up the process tree and into per-session and per-process-group
+ * totals, per cgroup v2 group and per user, and fits a rolling RSS trend per process
+ * to flag slow memory leaks. It counts threads by state and reports threads stuck
+ * in uninterruptible sleep for longer than a threshold, and ranks processes by the
+ * time their threads spent waiting for a CPU and by I/O rate.
+ * Fork, exec and exit tracepoints feed a per-CPU event stream so that processes
+ * too short-lived for any walk are still counted and their CPU time attributed.
+ * Statistics are split into per-subsystem files under /proc/system_monitor/, each
+ * rendered on first read after a sample so readers only pay for what they open.
+ * While nobody reads them, collection drops to system-wide history or stops.
+ * An optional flight recorder samples every CPU at a short period into per-CPU
+ * rings and freezes the seconds around a threshold or manual trigger into a dump,
+ * and an optional profiler samples kernel stacks from per-CPU timers. Wakeups
+ * can be counted per waker and per woken process to find frequent wakers.
  */
 
 #include <linux/module.h>
@@ -14,6 +30,7 @@
 #include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/sched/signal.h>
+#include <linux/sched/task.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/timer.h>
@@ -25,152 +42,4413 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/part_stat.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/hashtable.h>
+#include <linux/sort.h>
+#include <linux/pid_namespace.h>
+#include <linux/percpu.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/cgroup.h>
+#include <linux/memcontrol.h>
+#include <linux/cred.h>
+#include <linux/fs.h>
+#include <linux/mount.h>
+#include <linux/hrtimer.h>
+#include <linux/tick.h>
+#include <linux/workqueue.h>
+#include <linux/stacktrace.h>
+#include <linux/kallsyms.h>
+#include <linux/irq_regs.h>
+#include <linux/jump_label.h>
 
 /* Constants */
 #define PROC_NAME "system_monitor"
 #define PROC_CONTROL "system_monitor_control"
+#define PROC_EVENTS "system_monitor_events"
+#define PROC_TASK_EVENTS "system_monitor_tasks"
 #define HISTORY_SIZE 60
 #define MAX_PROCESSES 50
+#define CONTROL_BUF_SIZE 128
+#define MAX_ALERT_RULES 16
+#define ALERT_EVENT_RING 64
+#define ALERT_LINE_SIZE 128
+#define MIN_INTERVAL_MS 10
+#define MAX_INTERVAL_MS 60000
+#define ADAPT_SMOOTH_MS 1000
+#define ADAPT_PERSIST_MS 50
+#define MAX_TRACKED_TASKS 262144
+#define WALK_BATCH 1024
+#define WALK_SECTION_NS (250 * NSEC_PER_USEC)
+#define WALK_PAUSE_MIN_NS (20 * NSEC_PER_USEC)
+#define WALK_PAUSE_MAX_NS (5 * NSEC_PER_MSEC)
+#define GROUP_HASH_BITS 8
+#define MAX_TRACKED_GROUPS 4096
+#define MAX_GROUPS 20
+#define MAX_TREE_NODES 64
+#define MAX_TREE_DEPTH 64
+#define MAX_TOP_REFS 64
+#define CGROUP_PATH_LEN 256
+#define DSTATE_MIN_MS 5000
+#define MAX_DSTATE_TRACKED 4096
+#define MAX_DSTATE 20
+#define MAX_DELAYED 20
+#define MAX_IO_TOP 20
+#define CGROUP_STAT_BUF_SIZE 256
+#define CGROUP_STAT_BUF_MAX 4096
+#define LEAK_WINDOW 16
+#define LEAK_SAMPLE_MS 30000
+#define LEAK_MIN_RSS (32ULL << 20)
+#define LEAK_MIN_SLOPE 16384
+#define LEAK_SUSTAIN 4
+#define MAX_LEAK_TRACKED 4096
+#define MAX_LEAKS 10
+#define TASK_EVENT_RING 512
+#define TASK_EVENT_HIGH_WATER (TASK_EVENT_RING / 2)
+#define TASK_EVENT_LINE_SIZE 96
+#define COMM_HASH_BITS 8
+#define MAX_TRACKED_COMMS 1024
+#define MAX_COMMS 20
+#define COMM_IDLE_MS 600000
+#define SNAPSHOT_MIN_SIZE 4096
+#define SNAPSHOT_MAX_SIZE (4 * 1024 * 1024)
+#define RENDER_BUDGET 32
+#define RENDER_BUDGET_MS 1000
+#define IDLE_AFTER_MS 300000
+#define IDLE_RESUME_MS 2000
+#define FLIGHT_PERIOD_MS 10
+#define FLIGHT_RING 1024
+#define FLIGHT_MARGIN 64
+#define FLIGHT_CHECK_MS 100
+#define FLIGHT_PRE_MS 5000
+#define FLIGHT_POST_MS 2000
+#define FLIGHT_ROW_SIZE 64
+#define PROFILE_HZ 99
+#define MAX_PROFILE_HZ 1000
+#define PROFILE_DEPTH 8
+#define PROFILE_TRACE_DEPTH 48
+#define PROFILE_CPU_SLOTS 256
+#define PROFILE_PROBES 8
+#define PROFILE_HASH_BITS 10
+#define MAX_PROFILE_STACKS 4096
+#define MAX_PROFILE_FUNCS 4096
+#define PROFILE_COLD_MERGES 10
+#define MAX_PROFILE_TOP 20
+#define WAKEUP_CPU_SLOTS 256
+#define WAKEUP_PROBES 8
+#define WAKEUP_HASH_BITS 10
+#define MAX_WAKEUP_TRACKED 4096
+#define MAX_WAKEUPS 20
 
 /* Data Structures */
 
+// CPU time buckets in the order they are exported
+enum cpu_mode {
+    CPU_USER,
+    CPU_NICE,
+    CPU_SYSTEM,
+    CPU_IDLE,
+    CPU_IOWAIT,
+    CPU_IRQ,
+    CPU_SOFTIRQ,
+    CPU_STEAL,
+    CPU_GUEST,          // already included in CPU_USER
+    CPU_GUEST_NICE,     // already included in CPU_NICE
+    NR_CPU_MODES
+};
+
+static const int cpu_mode_index[NR_CPU_MODES] = {
+    [CPU_USER] = CPUTIME_USER,
+    [CPU_NICE] = CPUTIME_NICE,
+    [CPU_SYSTEM] = CPUTIME_SYSTEM,
+    [CPU_IDLE] = CPUTIME_IDLE,
+    [CPU_IOWAIT] = CPUTIME_IOWAIT,
+    [CPU_IRQ] = CPUTIME_IRQ,
+    [CPU_SOFTIRQ] = CPUTIME_SOFTIRQ,
+    [CPU_STEAL] = CPUTIME_STEAL,
+    [CPU_GUEST] = CPUTIME_GUEST,
+    [CPU_GUEST_NICE] = CPUTIME_GUEST_NICE,
+};
+
+// Scheduler activity counters, cumulative except for the two gauges
+struct sched_counters {
+    u64 ctx_switches;
+    u64 irqs;
+    u64 softirqs;
+    u64 forks;
+    u32 nr_running;
+    u32 nr_iowait;
+};
+
+// How much the monitor collects while nobody reads its files
+enum idle_mode {
+    IDLE_OFF,           // always collect everything
+    IDLE_HISTORY,       // keep sampling system-wide counters into the history
+    IDLE_STOP,          // collect nothing
+    NR_IDLE_MODES,
+};
+
+static const char * const idle_mode_names[NR_IDLE_MODES] = {
+    [IDLE_OFF] = "off",
+    [IDLE_HISTORY] = "history",
+    [IDLE_STOP] = "stop",
+};
+
+// Collection behind a history entry
+enum history_state {
+    HISTORY_FULL,
+    HISTORY_IDLE,       // no task walks during the interval
+    HISTORY_GAP,        // first sample after collection stopped; the interval spans the gap
+};
+
+// One sample in the history buffer
+struct history_entry {
+    u64 timestamp;      // ms since boot
+    u32 interval_ms;    // time since the previous sample, for time-weighted rollups
+    u32 cpu;            // busy CPU percent over the interval
+    u8 cpu_split[NR_CPU_MODES];     // percent of the interval spent in each mode
+    u64 mem_available;  // KB
+    struct sched_counters sched;    // changes over the interval; gauges as sampled
+    u8 state;           // enum history_state
+};
+
 // Circular buffer for historical stats
 static struct {
-    u64 cpu_usage[HISTORY_SIZE];
-    u64 mem_usage[HISTORY_SIZE];
+    struct history_entry entries[HISTORY_SIZE];
     int head;
     spinlock_t lock;
 } stats_history;
 
-// Store per-process statistics
-struct process_stats {
-    pid_t pid;
-    u64 cpu_time;
-    unsigned long vm_size;
-    char comm[TASK_COMM_LEN];
-};
+// Sampling cadence, changed through the control file under sampling_lock
+struct sampling_config {
+    unsigned int interval_ms;   // fixed interval; also the task walk cadence
+    bool adaptive;
+    unsigned int min_ms;        // adaptive bounds
+    unsigned int max_ms;
+    unsigned int cpu_delta;     // busy % change from the smoothed level that tightens the interval
+    unsigned int mem_delta;     // memory % change from the smoothed level that tightens the interval
+    int idle_mode;
+    unsigned int idle_after_ms; // time without readers before going idle
+};
+
+// Adaptive interval state of one metric: its level smoothed over about ADAPT_SMOOTH_MS,
+// and for how long samples have stayed on one side of it by at least the threshold
+struct adapt_metric {
+    s64 level;                  // in 1/256 percent
+    int side;                   // -1 below, 1 above, 0 within the threshold
+    u64 streak_ns;
+};
+
+// Resident memory of a process, from the mm's RSS counters (bytes)
+struct mem_usage {
+    u64 anon;
+    u64 file;
+    u64 shmem;
+    u64 swap;
+    s64 rss_growth;     // change of anon + file + shmem per second since the previous task walk
+};
+
+// Store per-process (or, for thread entries, per-thread) statistics
+struct process_stats {
+    pid_t pid;
+    pid_t tgid;         // owning process; equal to pid for processes
+    u64 cpu_time;
+    u64 cpu_delta;      // CPU time used since the previous task walk
+    struct mem_usage mem;
+    char comm[TASK_COMM_LEN];
+};
+
+// What the top_processes list is ranked by
+enum process_rank {
+    RANK_CPU,
+    RANK_RSS,
+    RANK_RSS_GROWTH,
+    NR_RANKS
+};
+
+static const char * const rank_names[NR_RANKS] = {
+    [RANK_CPU] = "cpu",
+    [RANK_RSS] = "rss",
+    [RANK_RSS_GROWTH] = "rss_growth",
+};
+
+// Bounded selection of the MAX_PROCESSES entries with the largest keys
+struct topn {
+    int count;
+    int min;            // slot holding the smallest key once full
+    struct topn_entry {
+        u64 key;
+        struct process_stats stats;
+    } entries[MAX_PROCESSES];
+};
+
+// Bounded selection of the largest keys among entries that outlive the selection
+struct ref_topn {
+    int count;
+    int cap;
+    int min;
+    struct ref_topn_entry {
+        u64 key;
+        void *ref;
+    } entries[MAX_TOP_REFS];
+};
+
+// State carried between task walks, keyed by pid (tgid for processes, tid for threads)
+struct task_track {
+    struct hlist_node node;
+    pid_t pid;
+    u64 start_time;     // tells a reused pid apart
+    u64 seen;           // walk generation that last visited the task
+    u64 cpu_time;
+};
+
+struct track_table {
+    struct hlist_head *buckets;  // sized to @max at load, two entries per bucket when full
+    unsigned int bits;
+    struct kmem_cache *cache;
+    size_t size;                // entry size: task_track plus any per-table extension
+    unsigned int max;
+    unsigned int count;
+    unsigned int untracked;     // tasks skipped in the last walk because the table was full
+};
+
+// Duration of task walks and of the RCU read-side sections they are split into
+struct walk_cost {
+    u64 sweep_ns;           // last walk, lock breaks included
+    u64 max_sweep_ns;
+    u64 section_ns;         // longest section of the last walk
+    u64 max_section_ns;
+    unsigned int sections;  // sections in the last walk
+    u64 pause_ns;           // time the last walk slept between sections
+};
+
+// Resources used by a set of tasks during one task walk
+struct group_stats {
+    u64 cpu_delta;
+    u64 rss;
+    u64 io_delta;
+    u32 nr_tasks;
+};
+
+// I/O counters of a process as in /proc/<pid>/io: its threads, exited threads
+// and reaped children
+struct io_usage {
+    u64 read_bytes;
+    u64 write_bytes;
+    u64 cancelled_write_bytes;
+    u64 syscr;
+    u64 syscw;
+};
+
+// Totals over a process's live threads, plus what exited threads left in the signal struct
+struct process_usage {
+    u64 cpu_time;
+    struct io_usage io;
+    u64 run_delay_delta;        // time runnable but waiting for a CPU (ns) since the last walk
+    u64 pcount_delta;           // times a thread was scheduled onto a CPU since the last walk
+};
+
+// Thread table entry: task_track plus the scheduler counters at the last walk
+struct thread_track {
+    struct task_track track;
+    u64 run_delay;
+    u64 pcount;
+};
+
+// Process table entry: task_track plus what the tree rollup and delay ranking need
+struct process_track {
+    struct task_track track;
+    u64 child_cpu;              // CPU time of reaped children at the last walk
+    struct io_usage io;         // at the last walk
+    struct io_usage io_delta;   // since the previous walk
+    u64 run_delay_delta;        // summed over the threads, since the previous walk
+    u64 pcount_delta;
+    u64 tree_seen;              // walk generation @self and @subtree belong to
+    struct group_stats self;
+    struct group_stats subtree; // self, live descendants and reaped children
+    pid_t ppid;
+    u16 depth;
+    char comm[TASK_COMM_LEN];
+};
+
+// Leak table entry: least-squares fit of RSS over the last LEAK_WINDOW samples,
+// against the time each sample was taken
+struct leak_track {
+    struct task_track track;
+    u32 rss[LEAK_WINDOW];       // pages, ring indexed from @head
+    u32 at_ms[LEAK_WINDOW];     // sample times; differences survive the u32 wrap
+    s64 slope;                  // bytes/s from the latest fit
+    u64 rising_since;           // ns, first fit of the current rising streak
+    u16 head;
+    u16 n;
+    u16 rising;                 // consecutive full-window fits at or above the threshold, saturating
+    char comm[TASK_COMM_LEN];
+};
+
+// Published leak suspect
+struct leak_entry {
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    u64 rss;
+    s64 slope;
+    u32 rising_ms;              // how long the slope has stayed above the threshold
+    u64 oom_ms;                 // projected time until available memory runs out
+};
+
+enum task_event_type {
+    TASK_EVENT_FORK,
+    TASK_EVENT_EXEC,
+    TASK_EVENT_EXIT,
+    NR_TASK_EVENTS
+};
+
+static const char * const task_event_names[NR_TASK_EVENTS] = {
+    [TASK_EVENT_FORK] = "fork",
+    [TASK_EVENT_EXEC] = "exec",
+    [TASK_EVENT_EXIT] = "exit",
+};
+
+// One fork (pid = parent, other = child), exec (other = pid before exec) or
+// exit (other = tgid, cpu_time = runtime of the exiting task)
+struct task_event {
+    u64 seq;                    // position in the CPU's ring; U64_MAX while being written
+    u64 timestamp;              // ns, monotonic
+    u64 cpu_time;
+    pid_t pid;
+    pid_t other;
+    u8 type;
+    char comm[TASK_COMM_LEN];
+};
+
+// Single-producer overwrite ring: only tracepoint probes on the owning CPU
+// write it, with preemption disabled. Readers never block the producer; a
+// reader that falls a full ring behind loses the oldest events.
+struct task_event_ring {
+    u64 head;
+    struct task_event slots[TASK_EVENT_RING];
+} ____cacheline_aligned;
+
+struct task_events {
+    struct task_event_ring __percpu *rings;
+    u64 *drain_cursor;          // per-CPU positions of the in-kernel aggregation
+    struct work_struct drain_work;
+    bool shutdown;
+    wait_queue_head_t wait;
+};
+
+// Per-file reader state; one cursor per possible CPU
+struct task_event_reader {
+    u64 lost;
+    u64 cursor[];
+};
+
+// Spawn and exit accounting per command name
+struct comm_track {
+    struct hlist_node node;
+    char comm[TASK_COMM_LEN];
+    u64 forks;
+    u64 execs;
+    u64 exits;
+    u64 exit_cpu;               // runtime of exited tasks, ns
+    u64 last_spawns;            // forks + execs at the previous publish
+    u64 last_exit_cpu;
+    u64 last_active;            // ns, monotonic
+};
+
+struct comm_entry {
+    char comm[TASK_COMM_LEN];
+    u64 forks;
+    u64 execs;
+    u64 exits;
+    u64 exit_cpu;
+    u64 spawn_delta;
+    u64 exit_cpu_delta;
+};
+
+// Published process that waited longest for a CPU since the previous walk
+struct delay_entry {
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    u64 run_delay_delta;
+    u64 pcount_delta;
+    u64 cpu_delta;
+};
+
+// Published I/O consumer, rates per second over the last walk interval
+struct io_entry {
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    struct io_usage rate;
+};
+
+// Published process tree node
+struct tree_node {
+    pid_t pid;
+    pid_t ppid;
+    int depth;
+    char comm[TASK_COMM_LEN];
+    u64 cpu_delta;
+    struct group_stats subtree;
+};
+
+// Per-walk totals of a session or process group, keyed by its id
+struct group_track {
+    struct hlist_node node;
+    u64 id;
+    u64 seen;
+    struct group_stats stats;
+    char comm[TASK_COMM_LEN];   // group leader, or the first member seen
+};
+
+struct group_table {
+    DECLARE_HASHTABLE(buckets, GROUP_HASH_BITS);
+    bool leader_ids;            // ids are the pid of a leader, whose command names the group
+    unsigned int count;
+    unsigned int untracked;
+};
+
+// Published group totals
+struct group_entry {
+    u64 id;
+    char comm[TASK_COMM_LEN];
+    struct group_stats stats;
+};
+
+// Thread states counted by the task walk
+enum task_census {
+    CENSUS_RUNNING,
+    CENSUS_INTERRUPTIBLE,
+    CENSUS_UNINTERRUPTIBLE,
+    CENSUS_STOPPED,         // stopped or traced
+    CENSUS_ZOMBIE,          // exited, not yet reaped
+    CENSUS_IDLE,            // idle or parked kernel threads
+    NR_CENSUS,
+};
+
+// D-state table entry, keyed by tid. Walks that find the same switch count
+// are seeing the same uninterruptible sleep.
+struct dstate_track {
+    struct task_track track;
+    u64 switches;
+    u64 since;                  // time of the walk that first saw this sleep
+    pid_t tgid;
+    char comm[TASK_COMM_LEN];
+};
+
+// Published long uninterruptible sleep
+struct dstate_entry {
+    pid_t pid;
+    pid_t tgid;
+    char comm[TASK_COMM_LEN];
+    u64 wait_ms;
+};
+
+// Published cgroup totals. Usage covers the cgroup and its descendants; throttling
+// and memory events are the cgroup's cumulative cpu.stat and memory.events counts.
+struct cgroup_entry {
+    struct group_entry group;
+    char path[CGROUP_PATH_LEN];
+    u64 nr_throttled;
+    u64 throttled_usec;
+    u64 mem_high;
+    u64 mem_max;
+    u64 mem_oom;
+    u64 mem_oom_kill;
+};
+
+// Metrics an alert rule can watch, indexing monitor_sample.metrics
+enum monitor_metric {
+    METRIC_CPU,         // busy CPU percent since the previous sample
+    METRIC_MEM,         // percent of RAM not available for new allocations
+    METRIC_MEM_AVAIL,   // available memory in KB
+    METRIC_PROCS,       // number of processes
+    METRIC_NET_RX,      // received bytes per second
+    METRIC_NET_TX,      // transmitted bytes per second
+    NR_METRICS,
+};
+
+static const char * const metric_names[NR_METRICS] = {
+    [METRIC_CPU] = "cpu",
+    [METRIC_MEM] = "mem",
+    [METRIC_MEM_AVAIL] = "mem_avail",
+    [METRIC_PROCS] = "procs",
+    [METRIC_NET_RX] = "net_rx",
+    [METRIC_NET_TX] = "net_tx",
+};
+
+// Per-CPU collector state. The probe-written counters and the monitor thread's
+// sample sit on separate cache lines so remote sampling never bounces the line
+// the local CPU increments on every context switch.
+struct cpu_collector {
+    // Written by tracepoint probes on this CPU
+    struct cpu_activity {
+        u64 ctx_switches;
+        u64 forks;
+        unsigned int nr_running;
+        struct io_usage exited_io;      // final I/O of tasks freed on this CPU
+    } activity ____cacheline_aligned;
+
+    // Written by the monitor thread under collector_lock
+    struct cpu_sched {
+        struct sched_counters total;    // cumulative at the last sample
+        struct sched_counters delta;    // change over the last interval
+        unsigned int nr_iowait;         // from the last complete task walk
+    } sched ____cacheline_aligned;
+};
+
+// Counters of CPUs that went offline, so totals over online CPUs never go backwards
+struct collector_retired {
+    struct sched_counters sched;
+    u64 cpu_time[NR_CPU_MODES];
+    struct io_usage exited_io;
+};
+
+// Cost of one pass over the online CPUs
+struct collector_cost {
+    u64 last_ns;
+    u64 max_ns;
+};
+
+// Text of one statistics file, rendered at most once per sample and never modified
+// afterwards. Readers take a reference inside an RCU read-side section and keep it while open.
+struct stats_snapshot {
+    struct rcu_head rcu;
+    refcount_t refs;
+    u64 seq;
+    size_t len;
+    char data[];
+};
+
+// A file under /proc/system_monitor/: the sections it shows and their latest rendering
+struct stats_view {
+    const char *name;
+    int (*show)(struct seq_file *m, void *v);
+    bool per_walk;              // shows only task walk results: stale once per walk, not per sample
+    struct stats_snapshot __rcu *snapshot;
+    struct mutex render_lock;
+    size_t size;
+};
+
+// Renderings of the statistics files allowed per window; opens of a stale file
+// beyond it are served the last rendering instead
+struct render_budget {
+    unsigned int renders;
+    unsigned int window_ms;
+    unsigned int used;
+    u64 window_start;
+    spinlock_t lock;
+};
+
+// How opens of the statistics files were served
+struct read_counters {
+    atomic64_t opens;
+    atomic64_t cached;      // latest sample already rendered
+    atomic64_t throttled;   // older sample, budget used up
+    atomic64_t renders;
+};
+
+enum flight_state {
+    FLIGHT_OFF,
+    FLIGHT_ARMED,
+    FLIGHT_TRIGGERED,       // recording the post-trigger window
+    NR_FLIGHT_STATES,
+};
+
+static const char * const flight_state_names[NR_FLIGHT_STATES] = {
+    [FLIGHT_OFF] = "off",
+    [FLIGHT_ARMED] = "armed",
+    [FLIGHT_TRIGGERED] = "triggered",
+};
+
+enum flight_trigger {
+    FLIGHT_MANUAL,
+    FLIGHT_CPU,
+    FLIGHT_RUNQ,
+    FLIGHT_MEM,
+    NR_FLIGHT_TRIGGERS,
+};
+
+static const char * const flight_trigger_names[NR_FLIGHT_TRIGGERS] = {
+    [FLIGHT_MANUAL] = "manual",
+    [FLIGHT_CPU] = "cpu",
+    [FLIGHT_RUNQ] = "runq",
+    [FLIGHT_MEM] = "mem",
+};
+
+// One flight recorder tick on one CPU
+struct flight_sample {
+    u64 timestamp;          // ktime_get_ns() at the tick
+    u32 busy_us;            // time not idle since the previous tick
+    u32 nr_running;
+    unsigned long free_pages;
+};
+
+// Overwrite ring written only by the owning CPU's pinned hrtimer. Readers stay
+// FLIGHT_MARGIN samples behind the slot it overwrites next.
+struct flight_ring {
+    struct hrtimer timer;
+    unsigned int cpu;
+    u64 last_ns;
+    u64 last_idle_us;
+    u64 head;
+    struct flight_sample samples[FLIGHT_RING];
+};
+
+// One FLIGHT_PERIOD_MS slice of a frozen recording, summed over CPUs
+struct flight_slot {
+    u64 busy_us;
+    u32 max_busy_us;
+    int busiest_cpu;
+    unsigned int samples;
+    unsigned int nr_running;
+    unsigned long free_pages;   // lowest seen in the slice
+};
+
+// A sampled stack: kernel frames leaf first, or for a sample taken in user
+// mode the process it interrupted and its user instruction pointer
+struct profile_stack {
+    u32 hash;
+    u32 count;                  // samples, in the per-CPU tables only
+    pid_t tgid;                 // user-mode samples only
+    unsigned int depth;         // frames in ips
+    char comm[TASK_COMM_LEN];
+    unsigned long ips[PROFILE_DEPTH];
+};
+
+// Samples taken on one CPU since the last merge, in an open-addressed table
+struct profile_table {
+    u64 kernel;
+    u64 user;
+    u64 idle;
+    u64 dropped;
+    struct profile_stack stacks[PROFILE_CPU_SLOTS];
+};
+
+// The sampling hrtimer writes tables[active]; only the merge switches active
+struct profile_cpu {
+    struct hrtimer timer;
+    unsigned int active;
+    struct profile_table tables[2];
+};
+
+// Merged samples of one kernel function, or of one process in user mode
+struct profile_func {
+    struct hlist_node node;
+    unsigned long start;        // function entry; 0 for user mode
+    pid_t tgid;
+    char comm[TASK_COMM_LEN];
+    u64 count;
+    unsigned int refs;          // merged stacks pointing here
+};
+
+// Merged samples of one stack
+struct profile_track {
+    struct hlist_node node;
+    struct profile_stack stack;
+    struct profile_func *func;  // NULL once MAX_PROFILE_FUNCS are tracked
+    u64 count;
+    u64 last_merge;             // merge that last added samples
+};
+
+struct profile_func_entry {
+    unsigned long start;
+    pid_t tgid;
+    char comm[TASK_COMM_LEN];
+    u64 count;
+};
+
+struct profile_stack_entry {
+    struct profile_stack stack;
+    u64 count;
+};
+
+// Context a wakeup was issued from
+enum wakeup_ctx {
+    WAKEUP_TASK,
+    WAKEUP_HARDIRQ,
+    WAKEUP_SOFTIRQ,
+    NR_WAKEUP_CTXS,
+};
+
+static const char * const wakeup_ctx_names[NR_WAKEUP_CTXS] = {
+    [WAKEUP_TASK] = "task",
+    [WAKEUP_HARDIRQ] = "[hardirq]",
+    [WAKEUP_SOFTIRQ] = "[softirq]",
+};
+
+// Wakeups of one process by one waker on one CPU since the last merge
+struct wakeup_count {
+    u32 hash;
+    u32 count;
+    pid_t waker;                // tgid; 0 outside task context
+    pid_t wakee;
+    int ctx;
+    char waker_comm[TASK_COMM_LEN];
+    char wakee_comm[TASK_COMM_LEN];
+};
+
+struct wakeup_table {
+    u64 dropped;
+    struct wakeup_count slots[WAKEUP_CPU_SLOTS];
+};
+
+// The probe writes tables[active]; only the merge switches active
+struct wakeup_cpu {
+    unsigned int active;
+    struct wakeup_table tables[2];
+};
+
+// Wakeups in the last merge interval of one process, or of one interrupt
+// context as a waker
+struct wakeup_track {
+    struct hlist_node node;
+    pid_t tgid;
+    int ctx;
+    char comm[TASK_COMM_LEN];
+    u64 woken;
+    u64 caused;
+};
+
+struct wakeup_entry {
+    pid_t tgid;
+    int ctx;
+    char comm[TASK_COMM_LEN];
+    u64 count;
+    u64 rate;                   // per second
+};
+
+// Values computed by the monitor thread on every sample
+struct monitor_sample {
+    u64 timestamp;      // ktime_get_ns() at collection
+    u64 cpu_time[NR_CPU_MODES];     // cumulative CPU time per mode (ns)
+    u64 rx_bytes;
+    u64 tx_bytes;
+    struct sched_counters sched;
+    u64 metrics[NR_METRICS];
+};
+
+enum alert_cmp {
+    ALERT_GT,
+    ALERT_GE,
+    ALERT_LT,
+    ALERT_LE,
+    NR_ALERT_CMPS,
+};
+
+static const char * const alert_cmp_names[NR_ALERT_CMPS] = {
+    [ALERT_GT] = ">",
+    [ALERT_GE] = ">=",
+    [ALERT_LT] = "<",
+    [ALERT_LE] = "<=",
+};
+
+// Threshold rule configured through the control file
+struct alert_rule {
+    bool active;
+    bool firing;
+    int metric;
+    int cmp;
+    u64 threshold;
+    u32 duration_ms;    // how long the condition must hold before a state change
+    u64 pending_since;  // when the condition started disagreeing with @firing, 0 if it agrees
+    u64 value;          // last evaluated metric value
+};
+
+// Firing or clearing of a rule, as queued for the event file
+struct alert_event {
+    u64 seq;
+    u64 timestamp_ms;   // wall clock
+    int rule;
+    int metric;
+    int cmp;
+    bool firing;
+    u64 threshold;
+    u64 value;
+};
+
+// Broadcast ring of alert events; every reader keeps its own cursor into it
+static struct {
+    struct alert_event ring[ALERT_EVENT_RING];
+    u64 next_seq;
+    bool shutdown;
+    spinlock_t lock;
+    wait_queue_head_t wait;
+} alert_events;
+
+static struct proc_dir_entry *proc_dir;
+static struct proc_dir_entry *control_entry;
+static struct proc_dir_entry *events_entry;
+static struct proc_dir_entry *task_events_entry;
+static struct timer_list stats_timer;
+static struct task_struct *monitor_thread;
+static int monitoring = 1;
+static struct process_stats top_processes[MAX_PROCESSES];
+static struct process_stats top_threads[MAX_PROCESSES];
+static int nr_top_processes;
+static int nr_top_threads;
+static DEFINE_MUTEX(stats_lock);
+static bool thread_mode;
+static bool sched_delay_mode;
+static int process_rank = RANK_CPU;
+static struct track_table process_table;
+static struct track_table thread_table;
+static struct track_table leak_table;
+static struct topn process_top;
+static struct topn thread_top;
+static struct group_table session_table = { .leader_ids = true };
+static struct group_table pgrp_table = { .leader_ids = true };
+static struct tree_node process_tree[MAX_TREE_NODES];
+static struct group_entry top_sessions[MAX_GROUPS];
+static struct group_entry top_pgrps[MAX_GROUPS];
+static int nr_tree_nodes;
+static int nr_top_sessions;
+static int nr_top_pgrps;
+static struct group_table cgroup_table;
+static struct delay_entry top_delayed[MAX_DELAYED];
+static int nr_top_delayed;
+static struct io_entry top_io[MAX_IO_TOP];
+static int nr_top_io;
+static struct io_usage io_totals;
+static struct io_usage io_base;     // live and freed I/O at the first complete walk
+static bool io_base_taken;
+static struct track_table dstate_table;
+static struct dstate_entry dstate_tasks[MAX_DSTATE];
+static int nr_dstate_tasks;
+static unsigned int dstate_min_ms = DSTATE_MIN_MS;
+static unsigned int task_census[NR_CENSUS];
+static int nr_processes;
+static struct group_table uid_table;
+static struct group_entry top_uids[MAX_GROUPS];
+static int nr_top_uids;
+static struct cgroup_entry top_cgroups[MAX_GROUPS];
+static struct cgroup_entry cgroup_staging[MAX_GROUPS];    // rendered outside stats_lock
+static struct vfsmount *cgroup_mnt;     // for reading cgroup interface files; only the monitor thread mounts it
+static int nr_top_cgroups;
+static struct leak_entry leaks[MAX_LEAKS];
+static int nr_leaks;
+static u64 last_leak_sample;
+static u64 leak_min_slope = LEAK_MIN_SLOPE;
+static struct task_events task_events;
+static DEFINE_PER_CPU_SHARED_ALIGNED(struct cpu_collector, cpu_collector);
+static struct cpumask collector_cpus;
+static struct collector_retired collector_retired;
+static struct collector_cost collector_cost;
+static DEFINE_SPINLOCK(collector_lock);
+static int collector_hp_state;
+static u64 sample_seq;
+static u64 walk_seq;
+static struct render_budget render_budget = {
+    .renders = RENDER_BUDGET,
+    .window_ms = RENDER_BUDGET_MS,
+    .lock = __SPIN_LOCK_UNLOCKED(render_budget.lock),
+};
+static struct read_counters read_counters;
+static DEFINE_HASHTABLE(comm_table, COMM_HASH_BITS);
+static DEFINE_MUTEX(comm_lock);
+static unsigned int nr_comms;
+static u64 comm_untracked;
+static u64 task_event_totals[NR_TASK_EVENTS];
+static u64 task_events_lost;
+static struct comm_entry top_comms[MAX_COMMS];
+static int nr_top_comms;
+static u64 walk_generation;
+static u64 last_walk_time;
+static u64 walk_elapsed;        // since the previous walk, for rates
+// Deltas would span a gap, or, for the first walk, the tasks' whole lifetime:
+// the walk only refreshes what they are taken against
+static bool walk_baseline = true;
+static unsigned int walk_aborts;
+static struct walk_cost walk_cost;
+static unsigned int walk_threads;   // threads seen by the last complete walk
+static struct alert_rule alert_rules[MAX_ALERT_RULES];
+static DEFINE_MUTEX(alert_lock);
+static struct sampling_config sampling = {
+    .interval_ms = 1000,
+    .adaptive = false,
+    .min_ms = MIN_INTERVAL_MS,
+    .max_ms = 10000,
+    .cpu_delta = 10,
+    .mem_delta = 5,
+    .idle_mode = IDLE_HISTORY,
+    .idle_after_ms = IDLE_AFTER_MS,
+};
+static DEFINE_MUTEX(sampling_lock);
+static unsigned int current_interval_ms = 1000;
+static DECLARE_WAIT_QUEUE_HEAD(monitor_wait);
+static bool monitor_kick;
+static bool monitor_idle;
+static unsigned int idle_periods;
+// Nobody reads task events while idle, and a stopped monitor samples no scheduler counters
+static DEFINE_STATIC_KEY_TRUE(task_events_key);
+static DEFINE_STATIC_KEY_TRUE(sched_counters_key);
+static u64 last_read_ns;
+static atomic_t subscribers = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(resume_wait);
+static struct {
+    struct flight_ring **rings;     // indexed by CPU while on; changed under cpus_read_lock()
+    struct cpumask ring_cpus;       // CPUs that have a ring; set when they first come online
+    struct delayed_work work;
+    int state;
+    int reason;
+    bool hold;                      // a threshold fired and has not cleared since
+    u64 trigger_ns;
+    unsigned int pre_ms;
+    unsigned int post_ms;
+    unsigned int cpu_pct;           // trigger thresholds; 0 disables
+    unsigned int runq;
+    u64 mem_kb;
+    unsigned int dumps;
+    struct stats_snapshot __rcu *dump;
+} flight = {
+    .pre_ms = FLIGHT_PRE_MS,
+    .post_ms = FLIGHT_POST_MS,
+};
+static DEFINE_MUTEX(flight_lock);
+static struct {
+    struct profile_cpu **cpus;      // indexed by CPU while on; changed under cpus_read_lock()
+    struct cpumask table_cpus;      // CPUs that have a table; set when they first come online
+    unsigned int hz;
+    u64 last_merge;
+    u64 kernel;
+    u64 user;
+    u64 idle;
+    u64 dropped;
+    u64 merges;
+    u64 evicted;                    // cold stacks forgotten to make room
+    unsigned int nr_stacks;
+    unsigned int nr_funcs;
+    struct profile_func_entry top_funcs[MAX_PROFILE_TOP];
+    struct profile_stack_entry top_stacks[MAX_PROFILE_TOP];
+    int nr_top_funcs;
+    int nr_top_stacks;
+} profile = {
+    .hz = PROFILE_HZ,
+};
+static DEFINE_MUTEX(profile_lock);
+static DEFINE_HASHTABLE(profile_stacks, PROFILE_HASH_BITS);
+static DEFINE_HASHTABLE(profile_funcs, PROFILE_HASH_BITS);
+static struct {
+    struct wakeup_cpu **cpus;       // per possible CPU while on
+    u64 last_merge;
+    u64 total;
+    u64 interval_total;
+    u64 rate;
+    u64 dropped;
+    unsigned int nr_tracked;
+    struct wakeup_entry sources[MAX_WAKEUPS];
+    struct wakeup_entry targets[MAX_WAKEUPS];
+    int nr_sources;
+    int nr_targets;
+} wakeups;
+static DEFINE_MUTEX(wakeup_lock);
+static DEFINE_HASHTABLE(wakeup_tracks, WAKEUP_HASH_BITS);
+
+static void topn_reset(struct topn *top) {
+    top->count = 0;
+    top->min = 0;
+}
+
+static void topn_offer(struct topn *top, u64 key, const struct process_stats *stats) {
+    int i, slot;
+
+    if (top->count < MAX_PROCESSES) {
+        slot = top->count++;
+    } else if (key > top->entries[top->min].key) {
+        slot = top->min;
+    } else {
+        return;
+    }
+
+    top->entries[slot].key = key;
+    top->entries[slot].stats = *stats;
+
+    if (top->count == MAX_PROCESSES) {
+        for (i = 0; i < MAX_PROCESSES; i++) {
+            if (top->entries[i].key < top->entries[top->min].key) top->min = i;
+        }
+    }
+}
+
+static int topn_cmp(const void *a, const void *b) {
+    const struct topn_entry *x = a, *y = b;
+
+    if (x->key == y->key) return 0;
+    return x->key > y->key ? -1 : 1;
+}
+
+// Sort largest first and copy out; caller holds stats_lock
+static int topn_publish(struct topn *top, struct process_stats *out) {
+    int i;
+
+    sort(top->entries, top->count, sizeof(top->entries[0]), topn_cmp, NULL);
+    for (i = 0; i < top->count; i++) {
+        out[i] = top->entries[i].stats;
+    }
+    return top->count;
+}
+
+static void ref_topn_reset(struct ref_topn *top, int cap) {
+    top->count = 0;
+    top->cap = min(cap, MAX_TOP_REFS);
+    top->min = 0;
+}
+
+static void ref_topn_offer(struct ref_topn *top, u64 key, void *ref) {
+    int i, slot;
+
+    if (top->count < top->cap) {
+        slot = top->count++;
+    } else if (key > top->entries[top->min].key) {
+        slot = top->min;
+    } else {
+        return;
+    }
+
+    top->entries[slot].key = key;
+    top->entries[slot].ref = ref;
+
+    if (top->count == top->cap) {
+        for (i = 0; i < top->cap; i++) {
+            if (top->entries[i].key < top->entries[top->min].key) top->min = i;
+        }
+    }
+}
+
+static int ref_topn_cmp(const void *a, const void *b) {
+    const struct ref_topn_entry *x = a, *y = b;
+
+    if (x->key == y->key) return 0;
+    return x->key > y->key ? -1 : 1;
+}
+
+static void ref_topn_sort(struct ref_topn *top) {
+    sort(top->entries, top->count, sizeof(top->entries[0]), ref_topn_cmp, NULL);
+}
+
+#define track_for_each(table, bkt, track) \
+    for (bkt = 0; bkt < (1 << (table)->bits); bkt++) \
+        hlist_for_each_entry(track, &(table)->buckets[bkt], node)
+
+static int track_table_alloc(struct track_table *table) {
+    table->bits = order_base_2(table->max) - 1;
+    table->buckets = kvcalloc(1 << table->bits, sizeof(*table->buckets), GFP_KERNEL);
+    return table->buckets ? 0 : -ENOMEM;
+}
+
+static struct task_track *track_find(struct track_table *table, pid_t pid) {
+    struct task_track *track;
+
+    hlist_for_each_entry(track, &table->buckets[hash_32(pid, table->bits)], node) {
+        if (track->pid == pid) return track;
+    }
+    return NULL;
+}
+
+// Find or create the entry for @task; a fresh entry has all state zeroed
+static struct task_track *track_get(struct track_table *table, struct task_struct *task, bool *fresh) {
+    struct task_track *track;
+
+    *fresh = false;
+    track = track_find(table, task->pid);
+    if (track) {
+        if (track->start_time != task->start_time) {
+            memset(&track->start_time, 0, table->size - offsetof(struct task_track, start_time));
+            track->start_time = task->start_time;
+            *fresh = true;
+        }
+        return track;
+    }
+
+    if (table->count >= table->max) {
+        table->untracked++;
+        return NULL;
+    }
+    track = kmem_cache_zalloc(table->cache, GFP_NOWAIT | __GFP_NOWARN);
+    if (!track) {
+        table->untracked++;
+        return NULL;
+    }
+
+    track->pid = task->pid;
+    track->start_time = task->start_time;
+    hlist_add_head(&track->node, &table->buckets[hash_32(track->pid, table->bits)]);
+    table->count++;
+    *fresh = true;
+    return track;
+}
+
+// Drop entries not visited by the walk of @generation (all entries if 0)
+static void track_prune(struct track_table *table, u64 generation) {
+    struct task_track *track;
+    struct hlist_node *tmp;
+    int bkt;
+
+    for (bkt = 0; bkt < (1 << table->bits); bkt++) {
+        hlist_for_each_entry_safe(track, tmp, &table->buckets[bkt], node) {
+            if (generation && track->seen == generation) continue;
+            hlist_del(&track->node);
+            kmem_cache_free(table->cache, track);
+            table->count--;
+        }
+    }
+}
+
+// Counter growth since the last walk; 0 for a new entry or a counter that went backwards
+static u64 counter_delta(u64 cur, u64 prev, bool fresh) {
+    return fresh || cur < prev ? 0 : cur - prev;
+}
+
+// CPU time used since the last walk; a task first seen after it started counts in full
+static u64 track_cpu_delta(struct task_track *track, bool fresh, struct task_struct *task, u64 cpu_time) {
+    u64 delta;
+
+    if (walk_baseline) {
+        delta = 0;
+    } else if (fresh) {
+        delta = task->start_time >= last_walk_time ? cpu_time : 0;
+    } else {
+        delta = cpu_time > track->cpu_time ? cpu_time - track->cpu_time : 0;
+    }
+    track->cpu_time = cpu_time;
+    track->seen = walk_generation;
+    return delta;
+}
+
+// Find or create the entry for @id, resetting totals left over from an earlier walk
+static struct group_track *group_get(struct group_table *table, u64 id, struct task_struct *task) {
+    struct group_track *group;
+
+    hash_for_each_possible(table->buckets, group, node, id) {
+        if (group->id == id) goto found;
+    }
+
+    if (table->count >= MAX_TRACKED_GROUPS) {
+        table->untracked++;
+        return NULL;
+    }
+    group = kzalloc(sizeof(*group), GFP_NOWAIT | __GFP_NOWARN);
+    if (!group) {
+        table->untracked++;
+        return NULL;
+    }
+    group->id = id;
+    hash_add(table->buckets, &group->node, id);
+    table->count++;
+
+found:
+    if (group->seen != walk_generation) {
+        memset(&group->stats, 0, sizeof(group->stats));
+        get_task_comm(group->comm, task);
+        group->seen = walk_generation;
+    }
+    if (table->leader_ids && task->pid == id) {
+        get_task_comm(group->comm, task);
+    }
+    return group;
+}
+
+static void group_prune(struct group_table *table, u64 generation) {
+    struct group_track *group;
+    struct hlist_node *tmp;
+    int bkt;
+
+    hash_for_each_safe(table->buckets, bkt, tmp, group, node) {
+        if (generation && group->seen == generation) continue;
+        hash_del(&group->node);
+        kfree(group);
+        table->count--;
+    }
+}
+
+static void group_add(struct group_stats *total, const struct group_stats *stats) {
+    total->cpu_delta += stats->cpu_delta;
+    total->rss += stats->rss;
+    total->io_delta += stats->io_delta;
+    total->nr_tasks += stats->nr_tasks;
+}
+
+// Copy the groups that used the most CPU in this walk into @out; caller holds stats_lock
+static int group_publish(struct group_table *table, struct group_entry *out) {
+    struct ref_topn top;
+    struct group_track *group;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_GROUPS);
+    hash_for_each(table->buckets, bkt, group, node) {
+        if (group->seen == walk_generation) {
+            ref_topn_offer(&top, group->stats.cpu_delta, group);
+        }
+    }
+    ref_topn_sort(&top);
+
+    for (i = 0; i < top.count; i++) {
+        group = top.entries[i].ref;
+        out[i].id = group->id;
+        memcpy(out[i].comm, group->comm, TASK_COMM_LEN);
+        out[i].stats = group->stats;
+    }
+    return top.count;
+}
+
+// Charge @pt's usage to the process's cgroup v2 group and every ancestor but the root
+static void cgroup_account(struct task_struct *task, const struct process_track *pt) {
+    struct cgroup *cgrp = task_dfl_cgroup(task);
+    struct group_track *group;
+
+    for (; cgroup_parent(cgrp); cgrp = cgroup_parent(cgrp)) {
+        group = group_get(&cgroup_table, cgroup_id(cgrp), task);
+        if (group) group_add(&group->stats, &pt->self);
+    }
+}
+
+#ifdef CONFIG_MEMCG
+// A controller's state in @cgrp with a reference held, or NULL if it is not enabled there
+static struct cgroup_subsys_state *cgroup_css_get(struct cgroup *cgrp, int ssid) {
+    struct cgroup_subsys_state *css;
+
+    rcu_read_lock();
+    css = rcu_dereference(cgrp->subsys[ssid]);
+    if (css && !css_tryget(css)) {
+        css = NULL;
+    }
+    rcu_read_unlock();
+    return css;
+}
+#endif
+
+#ifdef CONFIG_CGROUP_SCHED
+// Value of the "<key> <value>" line of a flat-keyed stat rendering
+static void stat_field(const char *buf, const char *key, u64 *val) {
+    size_t len = strlen(key);
+    const char *line;
+
+    for (line = buf; line; line = strchr(line, '\n')) {
+        if (*line == '\n') line++;
+        if (strncmp(line, key, len) == 0 && line[len] == ' ') {
+            sscanf(line + len + 1, "%llu", val);
+            return;
+        }
+    }
+}
+
+// The cgroup2 hierarchy, mounted privately on first use by the monitor thread, so that
+// paths from cgroup_path() resolve in its cgroup namespace. A failure is kept so that
+// a kernel without cgroup2 is not asked again on every walk.
+static struct vfsmount *cgroup_mount(void) {
+    struct file_system_type *type;
+
+    if (!cgroup_mnt) {
+        // cgroup2 is built in, so get_fs_type() holds no module reference to drop
+        type = get_fs_type("cgroup2");
+        cgroup_mnt = type ? vfs_kern_mount(type, SB_KERNMOUNT, type->name, NULL) : ERR_PTR(-ENODEV);
+    }
+    return cgroup_mnt;
+}
+
+// Read interface file @name of the cgroup at @path whole, into a NUL-terminated buffer
+// the caller frees. NULL if it cannot be read or is larger than CGROUP_STAT_BUF_MAX.
+static char *cgroup_file_read(const char *path, const char *name) {
+    struct vfsmount *mnt = cgroup_mount();
+    size_t size = CGROUP_STAT_BUF_SIZE, len = 0;
+    struct file *file;
+    char *file_path, *buf, *grown;
+    loff_t pos = 0;
+    ssize_t n = 0;
+
+    if (IS_ERR(mnt)) return NULL;
+    file_path = kasprintf(GFP_KERNEL, "%s/%s", path, name);
+    if (!file_path) return NULL;
+    file = file_open_root_mnt(mnt, file_path, O_RDONLY, 0);
+    kfree(file_path);
+    if (IS_ERR(file)) return NULL;
+
+    buf = kmalloc(size, GFP_KERNEL);
+    while (buf) {
+        n = kernel_read(file, buf + len, size - 1 - len, &pos);
+        if (n <= 0) break;
+        len += n;
+        if (len < size - 1) continue;
+        size *= 2;
+        grown = size <= CGROUP_STAT_BUF_MAX ? krealloc(buf, size, GFP_KERNEL) : NULL;
+        if (!grown) {
+            n = -EFBIG;
+            break;
+        }
+        buf = grown;
+    }
+    filp_close(file, NULL);
+    if (buf && n < 0) {
+        kfree(buf);
+        return NULL;
+    }
+    if (buf) {
+        buf[len] = '\0';
+    }
+    return buf;
+}
+
+// The bandwidth counters are private to the scheduler, so they are read from the
+// group's cpu.stat file the way any reader would. Without the cpu controller the
+// file has no such lines and the counters stay 0.
+static void cgroup_cpu_throttling(struct cgroup_entry *entry) {
+    char *buf = cgroup_file_read(entry->path, "cpu.stat");
+
+    if (!buf) return;
+    stat_field(buf, "nr_throttled", &entry->nr_throttled);
+    stat_field(buf, "throttled_usec", &entry->throttled_usec);
+    kfree(buf);
+}
+#endif
+
+#ifdef CONFIG_MEMCG
+static void cgroup_memory_events(struct cgroup *cgrp, struct cgroup_entry *entry) {
+    struct cgroup_subsys_state *css = cgroup_css_get(cgrp, memory_cgrp_id);
+    struct mem_cgroup *memcg;
+
+    if (!css) return;
+    memcg = mem_cgroup_from_css(css);
+    entry->mem_high = atomic_long_read(&memcg->memory_events[MEMCG_HIGH]);
+    entry->mem_max = atomic_long_read(&memcg->memory_events[MEMCG_MAX]);
+    entry->mem_oom = atomic_long_read(&memcg->memory_events[MEMCG_OOM]);
+    entry->mem_oom_kill = atomic_long_read(&memcg->memory_events[MEMCG_OOM_KILL]);
+    css_put(css);
+}
+#endif
+
+// Copy the cgroups that used the most CPU in this walk into @out, with their paths
+// and controller counters. Only these few are looked up again. Takes cgroup locks
+// and may sleep, so it runs before stats_lock is taken.
+static int cgroup_publish(struct cgroup_entry *out) {
+    struct group_entry top[MAX_GROUPS];
+    int count = group_publish(&cgroup_table, top);
+    int i, len;
+
+    for (i = 0; i < count; i++) {
+        struct cgroup *cgrp = cgroup_get_from_id(top[i].id);
+
+        memset(&out[i], 0, sizeof(out[i]));
+        out[i].group = top[i];
+        // Removed since the walk
+        if (IS_ERR_OR_NULL(cgrp)) {
+            strscpy(out[i].path, "?", sizeof(out[i].path));
+            continue;
+        }
+        len = cgroup_path(cgrp, out[i].path, sizeof(out[i].path));
+#ifdef CONFIG_CGROUP_SCHED
+        // A truncated path would name some other file
+        if (len >= 0 && len < sizeof(out[i].path)) {
+            cgroup_cpu_throttling(&out[i]);
+        }
+#endif
+#ifdef CONFIG_MEMCG
+        cgroup_memory_events(cgrp, &out[i]);
+#endif
+        cgroup_put(cgrp);
+    }
+    return count;
+}
+
+// task_lock keeps exit_mm() from dropping the mm while it is read
+static void task_mem_usage(struct task_struct *task, struct mem_usage *mem) {
+    memset(mem, 0, sizeof(*mem));
+
+    task_lock(task);
+    if (task->mm) {
+        mem->anon = (u64)get_mm_counter(task->mm, MM_ANONPAGES) << PAGE_SHIFT;
+        mem->file = (u64)get_mm_counter(task->mm, MM_FILEPAGES) << PAGE_SHIFT;
+        mem->shmem = (u64)get_mm_counter(task->mm, MM_SHMEMPAGES) << PAGE_SHIFT;
+        mem->swap = (u64)get_mm_counter(task->mm, MM_SWAPENTS) << PAGE_SHIFT;
+    }
+    task_unlock(task);
+}
+
+// Slope of the fitted line in bytes/s: cov(x, y) / var(x), both scaled by n^2.
+// x is milliseconds since the oldest sample, since walks are not exactly
+// LEAK_SAMPLE_MS apart.
+static s64 leak_slope(const struct leak_track *lt) {
+    unsigned int first = (lt->head + LEAK_WINDOW - lt->n) % LEAK_WINDOW;
+    s64 n = lt->n, sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0, num, den;
+    u64 slope;
+    int i;
+
+    if (n < 3) return 0;
+    for (i = 0; i < n; i++) {
+        unsigned int k = (first + i) % LEAK_WINDOW;
+        s64 x = (u32)(lt->at_ms[k] - lt->at_ms[first]);
+        s64 y = lt->rss[k];
+
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+    num = n * sum_xy - sum_x * sum_y;
+    den = n * sum_xx - sum_x * sum_x;
+    if (den <= 0) return 0;
+
+    slope = mul_u64_u64_div_u64(abs(num), PAGE_SIZE * MSEC_PER_SEC, den);
+    return num < 0 ? -(s64)slope : (s64)slope;
+}
+
+static void leak_sample(struct task_struct *task, const char *comm, u64 rss) {
+    struct task_track *track;
+    struct leak_track *lt;
+    u32 pages = rss >> PAGE_SHIFT;
+    u64 now = ktime_get_ns();
+    u32 now_ms = div_u64(now, NSEC_PER_MSEC);
+    bool fresh;
+
+    // Small processes are only fitted once they grow past LEAK_MIN_RSS
+    if (rss < LEAK_MIN_RSS && !track_find(&leak_table, task->pid)) return;
+
+    track = track_get(&leak_table, task, &fresh);
+    if (!track) return;
+    track->seen = walk_generation;
+    lt = container_of(track, struct leak_track, track);
+    memcpy(lt->comm, comm, TASK_COMM_LEN);
+
+    // A window spanning a pause in sampling, e.g. an idle period, starts over
+    if (lt->n && now_ms - lt->at_ms[(lt->head + LEAK_WINDOW - 1) % LEAK_WINDOW] > LEAK_WINDOW * LEAK_SAMPLE_MS) {
+        lt->n = 0;
+    }
+    // A full window overwrites its oldest sample
+    lt->rss[lt->head] = pages;
+    lt->at_ms[lt->head] = now_ms;
+    lt->head = (lt->head + 1) % LEAK_WINDOW;
+    if (lt->n < LEAK_WINDOW) {
+        lt->n++;
+    }
+
+    lt->slope = leak_slope(lt);
+    if (lt->n == LEAK_WINDOW && lt->slope >= (s64)READ_ONCE(leak_min_slope)) {
+        if (!lt->rising) {
+            lt->rising_since = now;
+        }
+        if (lt->rising < U16_MAX) {
+            lt->rising++;
+        }
+    } else {
+        lt->rising = 0;
+    }
+}
+
+// Copy the steepest sustained leaks into leaks[]; caller holds stats_lock
+static int leak_publish(struct leak_entry *out, u64 now) {
+    struct ref_topn top;
+    struct task_track *track;
+    u64 available = (u64)si_mem_available() << PAGE_SHIFT;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_LEAKS);
+    track_for_each(&leak_table, bkt, track) {
+        struct leak_track *lt = container_of(track, struct leak_track, track);
+
+        if (track->seen == walk_generation && lt->rising >= LEAK_SUSTAIN) {
+            ref_topn_offer(&top, lt->slope, lt);
+        }
+    }
+    ref_topn_sort(&top);
+
+    for (i = 0; i < top.count; i++) {
+        const struct leak_track *lt = top.entries[i].ref;
+
+        out[i].pid = lt->track.pid;
+        memcpy(out[i].comm, lt->comm, TASK_COMM_LEN);
+        out[i].rss = (u64)lt->rss[(lt->head + LEAK_WINDOW - 1) % LEAK_WINDOW] << PAGE_SHIFT;
+        out[i].slope = lt->slope;
+        out[i].rising_ms = min_t(u64, div_u64(now - lt->rising_since, NSEC_PER_MSEC), U32_MAX);
+        out[i].oom_ms = div64_u64(available * MSEC_PER_SEC, lt->slope);
+    }
+    return top.count;
+}
+
+static u64 rank_key(const struct process_stats *stats, u64 rss, int rank) {
+    switch (rank) {
+    case RANK_RSS:
+        return rss;
+    case RANK_RSS_GROWTH:
+        return stats->mem.rss_growth > 0 ? stats->mem.rss_growth : 0;
+    default:
+        return stats->cpu_delta;
+    }
+}
+
+// Charge @task's scheduling delay since the last walk to its process's @usage and,
+// in thread mode, offer the thread for the thread ranking. The delay counters of an
+// exited thread leave no trace in its process, so they are followed per thread.
+static void sample_thread(struct task_struct *task, u64 cpu_time, struct process_usage *usage, bool threads) {
+    struct process_stats stats;
+    struct task_track *track;
+    struct thread_track *tt;
+    bool fresh;
+
+    track = track_get(&thread_table, task, &fresh);
+    if (!track) return;
+    tt = container_of(track, struct thread_track, track);
+
+    stats.cpu_delta = track_cpu_delta(track, fresh, task, cpu_time);
+#ifdef CONFIG_SCHED_INFO
+    // Same rule as for CPU time: a thread started since the last walk counts in full
+    if (!walk_baseline && (!fresh || task->start_time >= last_walk_time)) {
+        usage->run_delay_delta += counter_delta(task->sched_info.run_delay, tt->run_delay, false);
+        usage->pcount_delta += counter_delta(task->sched_info.pcount, tt->pcount, false);
+    }
+    tt->run_delay = task->sched_info.run_delay;
+    tt->pcount = task->sched_info.pcount;
+#endif
+    if (!threads) return;
+
+    stats.pid = task->pid;
+    stats.tgid = task->tgid;
+    stats.cpu_time = cpu_time;
+    memset(&stats.mem, 0, sizeof(stats.mem));
+    get_task_comm(stats.comm, task);
+    topn_offer(&thread_top, stats.cpu_delta, &stats);
+}
+
+static int census_class(struct task_struct *task) {
+    switch (task_state_to_char(task)) {
+    case 'R':
+        return CENSUS_RUNNING;
+    case 'S':
+        return CENSUS_INTERRUPTIBLE;
+    case 'D':
+        return CENSUS_UNINTERRUPTIBLE;
+    case 'T':
+    case 't':
+        return CENSUS_STOPPED;
+    case 'Z':
+    case 'X':
+        return CENSUS_ZOMBIE;
+    default:
+        return CENSUS_IDLE;
+    }
+}
+
+// Note that @task is in uninterruptible sleep at @now; a new sleep restarts the clock
+static void dstate_sample(struct task_struct *task, u64 now) {
+    struct task_track *track;
+    struct dstate_track *dt;
+    u64 switches = task->nvcsw + task->nivcsw;
+    bool fresh;
+
+    track = track_get(&dstate_table, task, &fresh);
+    if (!track) return;
+    dt = container_of(track, struct dstate_track, track);
+
+    if (fresh || dt->switches != switches) {
+        dt->switches = switches;
+        dt->since = now;
+        dt->tgid = task->tgid;
+        get_task_comm(dt->comm, task);
+    }
+    track->seen = walk_generation;
+}
+
+// Copy the longest sleeps past the threshold into @out; caller holds stats_lock
+static int dstate_publish(struct dstate_entry *out, u64 now) {
+    u64 min_ns = (u64)READ_ONCE(dstate_min_ms) * NSEC_PER_MSEC;
+    struct ref_topn top;
+    struct task_track *track;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_DSTATE);
+    track_for_each(&dstate_table, bkt, track) {
+        struct dstate_track *dt = container_of(track, struct dstate_track, track);
+
+        if (track->seen == walk_generation && now - dt->since >= min_ns) {
+            ref_topn_offer(&top, now - dt->since, dt);
+        }
+    }
+    ref_topn_sort(&top);
+
+    for (i = 0; i < top.count; i++) {
+        const struct dstate_track *dt = top.entries[i].ref;
+
+        out[i].pid = dt->track.pid;
+        out[i].tgid = dt->tgid;
+        memcpy(out[i].comm, dt->comm, TASK_COMM_LEN);
+        out[i].wait_ms = div_u64(top.entries[i].key, NSEC_PER_MSEC);
+    }
+    return top.count;
+}
+
+// Leave the RCU read-side section so a long walk does not stall grace periods,
+// sleeping for @pause_ns if set. Returns false if process @task left the task list
+// or @thread left its thread list meanwhile, and the walk cannot resume.
+static bool walk_lock_break(struct task_struct *task, struct task_struct *thread, u64 pause_ns) {
+    unsigned long pause_us = div_u64(pause_ns, NSEC_PER_USEC);
+    bool can_continue;
+
+    get_task_struct(task);
+    get_task_struct(thread);
+    rcu_read_unlock();
+    if (pause_us) {
+        usleep_range(pause_us, pause_us + pause_us / 8);
+    } else {
+        cond_resched();
+    }
+    rcu_read_lock();
+    // Unhashing a task removes it from both lists and clears its pid
+    can_continue = pid_alive(task) && pid_alive(thread);
+    put_task_struct(thread);
+    put_task_struct(task);
+
+    return can_continue;
+}
+
+// Add @pt's usage to every ancestor's subtree. Ancestors are always visited first:
+// the task list is in fork order and a reparented task moves to an older process.
+static void rollup_ancestors(struct task_struct *task, struct process_track *pt) {
+    struct task_struct *parent = rcu_dereference(task->real_parent);
+    int depth = 0;
+
+    pt->ppid = parent->tgid;
+    while (parent->pid && depth < MAX_TREE_DEPTH) {
+        struct task_track *track = track_find(&process_table, parent->tgid);
+
+        if (track) {
+            struct process_track *ancestor = container_of(track, struct process_track, track);
+
+            if (ancestor->tree_seen == walk_generation) {
+                group_add(&ancestor->subtree, &pt->subtree);
+            }
+        }
+        parent = rcu_dereference(parent->real_parent);
+        depth++;
+    }
+    pt->depth = depth;
+}
+
+static u64 per_second(u64 delta, u64 elapsed_ns) {
+    return elapsed_ns ? mul_u64_u64_div_u64(delta, NSEC_PER_SEC, elapsed_ns) : 0;
+}
+
+static void io_add(struct io_usage *io, const struct task_io_accounting *ioac) {
+    io->read_bytes += ioac->read_bytes;
+    io->write_bytes += ioac->write_bytes;
+    io->cancelled_write_bytes += ioac->cancelled_write_bytes;
+#ifdef CONFIG_TASK_XACCT
+    io->syscr += ioac->syscr;
+    io->syscw += ioac->syscw;
+#endif
+}
+
+static void io_sum(struct io_usage *total, const struct io_usage *io) {
+    total->read_bytes += io->read_bytes;
+    total->write_bytes += io->write_bytes;
+    total->cancelled_write_bytes += io->cancelled_write_bytes;
+    total->syscr += io->syscr;
+    total->syscw += io->syscw;
+}
+
+static void io_delta(struct io_usage *delta, const struct io_usage *cur, const struct io_usage *prev, bool fresh) {
+    delta->read_bytes = counter_delta(cur->read_bytes, prev->read_bytes, fresh);
+    delta->write_bytes = counter_delta(cur->write_bytes, prev->write_bytes, fresh);
+    delta->cancelled_write_bytes = counter_delta(cur->cancelled_write_bytes, prev->cancelled_write_bytes, fresh);
+    delta->syscr = counter_delta(cur->syscr, prev->syscr, fresh);
+    delta->syscw = counter_delta(cur->syscw, prev->syscw, fresh);
+}
+
+static void read_cpu_exited_io(int cpu, struct io_usage *io) {
+    const struct io_usage *e = &per_cpu(cpu_collector, cpu).activity.exited_io;
+
+    io->read_bytes = READ_ONCE(e->read_bytes);
+    io->write_bytes = READ_ONCE(e->write_bytes);
+    io->cancelled_write_bytes = READ_ONCE(e->cancelled_write_bytes);
+    io->syscr = READ_ONCE(e->syscr);
+    io->syscw = READ_ONCE(e->syscw);
+}
+
+static void io_accumulate(struct io_usage *total, const struct io_usage *io, int sign) {
+    total->read_bytes += sign * io->read_bytes;
+    total->write_bytes += sign * io->write_bytes;
+    total->cancelled_write_bytes += sign * io->cancelled_write_bytes;
+    total->syscr += sign * io->syscr;
+    total->syscw += sign * io->syscw;
+}
+
+// I/O of every task freed since the module was loaded
+static void read_exited_io(struct io_usage *total) {
+    struct io_usage io;
+    int cpu;
+
+    spin_lock(&collector_lock);
+    *total = collector_retired.exited_io;
+    for_each_cpu(cpu, &collector_cpus) {
+        read_cpu_exited_io(cpu, &io);
+        io_sum(total, &io);
+    }
+    spin_unlock(&collector_lock);
+}
+
+static u64 io_since(u64 total, u64 cur, u64 base) {
+    return cur > base ? max(total, cur - base) : total;
+}
+
+// Totals are recomputed from scratch by every complete walk. A task freed after the
+// freed counters were read but before the walk reached it is in neither sum until
+// the next walk, so a field that comes out lower keeps its last value; the I/O is
+// not lost, the next walk counts it.
+static void io_settle(struct io_usage *total, const struct io_usage *cur, const struct io_usage *base) {
+    total->read_bytes = io_since(total->read_bytes, cur->read_bytes, base->read_bytes);
+    total->write_bytes = io_since(total->write_bytes, cur->write_bytes, base->write_bytes);
+    total->cancelled_write_bytes = io_since(total->cancelled_write_bytes, cur->cancelled_write_bytes,
+                                            base->cancelled_write_bytes);
+    total->syscr = io_since(total->syscr, cur->syscr, base->syscr);
+    total->syscw = io_since(total->syscw, cur->syscw, base->syscw);
+}
+
+static void sample_process(struct task_struct *task, const struct process_usage *usage, int rank, bool leak_walk) {
+    struct process_stats stats;
+    struct task_track *track;
+    struct process_track *pt;
+    struct group_track *group;
+    u64 child_cpu = task->signal->cutime + task->signal->cstime;
+    u64 child_delta, rss;
+    bool fresh;
+
+    track = track_get(&process_table, task, &fresh);
+    if (!track) return;
+    pt = container_of(track, struct process_track, track);
+    // A baseline walk treats every process as new
+    fresh |= walk_baseline;
+
+    stats.pid = task->pid;
+    stats.tgid = task->tgid;
+    stats.cpu_time = usage->cpu_time;
+    stats.cpu_delta = track_cpu_delta(track, fresh, task, usage->cpu_time);
+    get_task_comm(stats.comm, task);
+
+    child_delta = fresh || child_cpu < pt->child_cpu ? 0 : child_cpu - pt->child_cpu;
+    pt->self.cpu_delta = stats.cpu_delta;
+    task_mem_usage(task, &stats.mem);
+    rss = stats.mem.anon + stats.mem.file + stats.mem.shmem;
+    if (!fresh && rss >= pt->self.rss) {
+        stats.mem.rss_growth = per_second(rss - pt->self.rss, walk_elapsed);
+    } else if (!fresh) {
+        stats.mem.rss_growth = -(s64)per_second(pt->self.rss - rss, walk_elapsed);
+    }
+    pt->self.rss = rss;
+    if (leak_walk) {
+        leak_sample(task, stats.comm, rss);
+    }
+    io_delta(&pt->io_delta, &usage->io, &pt->io, fresh);
+    pt->self.io_delta = pt->io_delta.read_bytes + pt->io_delta.write_bytes;
+    pt->self.nr_tasks = 1;
+    pt->child_cpu = child_cpu;
+    pt->io = usage->io;
+    pt->run_delay_delta = usage->run_delay_delta;
+    pt->pcount_delta = usage->pcount_delta;
+    memcpy(pt->comm, stats.comm, TASK_COMM_LEN);
+
+    // Short-lived children are only visible through the time their parent reaped
+    pt->subtree = pt->self;
+    pt->subtree.cpu_delta += child_delta;
+    pt->tree_seen = walk_generation;
+    rollup_ancestors(task, pt);
+
+    group = group_get(&session_table, task_session_nr_ns(task, &init_pid_ns), task);
+    if (group) group_add(&group->stats, &pt->self);
+    group = group_get(&pgrp_table, task_pgrp_nr_ns(task, &init_pid_ns), task);
+    if (group) group_add(&group->stats, &pt->self);
+    cgroup_account(task, pt);
+    group = group_get(&uid_table, from_kuid_munged(&init_user_ns, task_uid(task)), task);
+    if (group) group_add(&group->stats, &pt->self);
+
+    topn_offer(&process_top, rank_key(&stats, rss, rank), &stats);
+}
+
+// Rank by subtree CPU, shallower first on ties. An ancestor's subtree always covers
+// its descendants', so the selected nodes form a connected tree.
+static int tree_publish(struct tree_node *out) {
+    struct ref_topn top;
+    struct task_track *track;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_TREE_NODES);
+    track_for_each(&process_table, bkt, track) {
+        struct process_track *pt = container_of(track, struct process_track, track);
+
+        if (pt->tree_seen != walk_generation) continue;
+        ref_topn_offer(&top, (pt->subtree.cpu_delta << 8) | (255 - min_t(u16, pt->depth, 255)), pt);
+    }
+    ref_topn_sort(&top);
+
+    for (i = 0; i < top.count; i++) {
+        const struct process_track *pt = top.entries[i].ref;
+
+        out[i].pid = pt->track.pid;
+        out[i].ppid = pt->ppid;
+        out[i].depth = pt->depth;
+        memcpy(out[i].comm, pt->comm, TASK_COMM_LEN);
+        out[i].cpu_delta = pt->self.cpu_delta;
+        out[i].subtree = pt->subtree;
+    }
+    return top.count;
+}
+
+// Copy the processes that waited longest for a CPU in this walk into @out; caller holds stats_lock
+static int delay_publish(struct delay_entry *out) {
+    struct ref_topn top;
+    struct task_track *track;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_DELAYED);
+    track_for_each(&process_table, bkt, track) {
+        struct process_track *pt = container_of(track, struct process_track, track);
+
+        if (pt->tree_seen == walk_generation && pt->run_delay_delta) {
+            ref_topn_offer(&top, pt->run_delay_delta, pt);
+        }
+    }
+    ref_topn_sort(&top);
+
+    for (i = 0; i < top.count; i++) {
+        const struct process_track *pt = top.entries[i].ref;
+
+        out[i].pid = pt->track.pid;
+        memcpy(out[i].comm, pt->comm, TASK_COMM_LEN);
+        out[i].run_delay_delta = pt->run_delay_delta;
+        out[i].pcount_delta = pt->pcount_delta;
+        out[i].cpu_delta = pt->self.cpu_delta;
+    }
+    return top.count;
+}
+
+// Copy the processes that read and wrote the most in this walk into @out, as rates
+// over @elapsed_ns; caller holds stats_lock
+static int io_publish(struct io_entry *out, u64 elapsed_ns) {
+    struct ref_topn top;
+    struct task_track *track;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_IO_TOP);
+    track_for_each(&process_table, bkt, track) {
+        struct process_track *pt = container_of(track, struct process_track, track);
+
+        if (pt->tree_seen == walk_generation && pt->self.io_delta) {
+            ref_topn_offer(&top, pt->self.io_delta, pt);
+        }
+    }
+    ref_topn_sort(&top);
+
+    for (i = 0; i < top.count; i++) {
+        const struct process_track *pt = top.entries[i].ref;
+        const struct io_usage *d = &pt->io_delta;
+
+        out[i].pid = pt->track.pid;
+        memcpy(out[i].comm, pt->comm, TASK_COMM_LEN);
+        out[i].rate.read_bytes = per_second(d->read_bytes, elapsed_ns);
+        out[i].rate.write_bytes = per_second(d->write_bytes, elapsed_ns);
+        out[i].rate.cancelled_write_bytes = per_second(d->cancelled_write_bytes, elapsed_ns);
+        out[i].rate.syscr = per_second(d->syscr, elapsed_ns);
+        out[i].rate.syscw = per_second(d->syscw, elapsed_ns);
+    }
+    return top.count;
+}
+
+static void walk_section_end(struct walk_cost *cost, u64 section_start) {
+    u64 section_ns = local_clock() - section_start;
+
+    cost->section_ns = max(cost->section_ns, section_ns);
+    cost->sections++;
+}
+
+// Walk all processes (and their threads), rank them by CPU used since the last walk.
+// The walk leaves its RCU read-side section after WALK_BATCH threads or WALK_SECTION_NS,
+// whichever comes first, and resumes from the thread it stopped at. Between sections it
+// sleeps so that a large walk is spread over up to half the sampling interval.
+static int collect_process_stats(void) {
+    struct task_struct *task, *thread;
+    bool threads = READ_ONCE(thread_mode);
+    bool delays = IS_ENABLED(CONFIG_SCHED_INFO) && READ_ONCE(sched_delay_mode);
+    // Scheduling delay is summed from per-thread deltas, so it needs every thread tracked
+    bool track_threads = threads || delays;
+    int rank = READ_ONCE(process_rank);
+    bool complete = true;
+    int count = 0, batch = 0, nr_cgroups = 0;
+    u64 now = ktime_get_ns();
+    bool leak_walk = !last_leak_sample || now - last_leak_sample >= (u64)LEAK_SAMPLE_MS * NSEC_PER_MSEC;
+    unsigned int *iowait = kcalloc(nr_cpu_ids, sizeof(*iowait), GFP_KERNEL);
+    unsigned int census[NR_CENSUS] = {};
+    struct io_usage live_io = {}, freed_io;
+    struct walk_cost cost = {};
+    u64 sweep_start = local_clock(), section_start;
+    u64 spread_ns = (u64)READ_ONCE(current_interval_ms) * NSEC_PER_MSEC / 2;
+    u64 pause_ns = min_t(u64, div_u64(spread_ns, walk_threads / WALK_BATCH + 1), WALK_PAUSE_MAX_NS);
+    int cpu, i;
+
+    walk_generation++;
+    walk_elapsed = last_walk_time ? now - last_walk_time : 0;
+    process_table.untracked = 0;
+    thread_table.untracked = 0;
+    session_table.untracked = 0;
+    pgrp_table.untracked = 0;
+    cgroup_table.untracked = 0;
+    uid_table.untracked = 0;
+    dstate_table.untracked = 0;
+    if (leak_walk) {
+        leak_table.untracked = 0;
+        last_leak_sample = now;
+    }
+    topn_reset(&process_top);
+    topn_reset(&thread_top);
+    if (!track_threads && thread_table.count) {
+        track_prune(&thread_table, 0);
+    }
+
+    // Read before the walk, so no task can be in both sums
+    read_exited_io(&freed_io);
+    rcu_read_lock();
+    section_start = local_clock();
+    for_each_process(task) {
+        // Usage of exited threads (and, for I/O, reaped children) is folded into the signal struct
+        struct process_usage usage = {
+            .cpu_time = task->signal->utime + task->signal->stime,
+        };
+
+        io_add(&usage.io, &task->signal->ioac);
+
+        for_each_thread(task, thread) {
+            u64 thread_cpu = thread->utime + thread->stime;
+            int state = census_class(thread);
+
+            census[state]++;
+            if (state == CENSUS_UNINTERRUPTIBLE) {
+                dstate_sample(thread, now);
+            }
+            usage.cpu_time += thread_cpu;
+            io_add(&usage.io, &thread->ioac);
+            io_add(&live_io, &thread->ioac);
+            if (iowait && thread->in_iowait && (READ_ONCE(thread->__state) & TASK_UNINTERRUPTIBLE)) {
+                iowait[task_cpu(thread)]++;
+            }
+            if (track_threads) {
+                sample_thread(thread, thread_cpu, &usage, threads);
+            }
+
+            if (++batch >= WALK_BATCH || local_clock() - section_start >= WALK_SECTION_NS) {
+                u64 pause = 0;
+
+                batch = 0;
+                walk_section_end(&cost, section_start);
+                // Pause only while the walk stays within its share of the interval
+                if (pause_ns >= WALK_PAUSE_MIN_NS && local_clock() - sweep_start + pause_ns <= spread_ns) {
+                    pause = pause_ns;
+                    cost.pause_ns += pause;
+                }
+                if (!walk_lock_break(task, thread, pause)) {
+                    complete = false;
+                    break;
+                }
+                section_start = local_clock();
+            }
+        }
+        if (!complete) break;
+        count++;
+
+        sample_process(task, &usage, rank, leak_walk);
+    }
+    // An aborted walk ended its last section before the lock break
+    if (complete) {
+        walk_section_end(&cost, section_start);
+    }
+    rcu_read_unlock();
+    cost.sweep_ns = local_clock() - sweep_start;
+    io_sum(&live_io, &freed_io);
+
+    if (!walk_baseline) {
+        nr_cgroups = cgroup_publish(cgroup_staging);
+    }
+
+    // An aborted walk did not visit every task, so keep unvisited state for next time
+    mutex_lock(&stats_lock);
+    if (walk_baseline) {
+        // Every delta is zero: lists ranked by them would be arbitrary
+        nr_top_processes = rank == RANK_RSS ? topn_publish(&process_top, top_processes) : 0;
+        nr_top_threads = 0;
+        nr_tree_nodes = 0;
+        nr_top_delayed = 0;
+        nr_top_io = 0;
+        nr_top_sessions = 0;
+        nr_top_pgrps = 0;
+        nr_top_cgroups = 0;
+        nr_top_uids = 0;
+    } else {
+        nr_top_processes = topn_publish(&process_top, top_processes);
+        nr_top_threads = topn_publish(&thread_top, top_threads);
+        nr_tree_nodes = tree_publish(process_tree);
+        nr_top_delayed = delays ? delay_publish(top_delayed) : 0;
+        nr_top_io = io_publish(top_io, now - last_walk_time);
+        nr_top_sessions = group_publish(&session_table, top_sessions);
+        nr_top_pgrps = group_publish(&pgrp_table, top_pgrps);
+        memcpy(top_cgroups, cgroup_staging, nr_cgroups * sizeof(*top_cgroups));
+        nr_top_cgroups = nr_cgroups;
+        nr_top_uids = group_publish(&uid_table, top_uids);
+    }
+    nr_dstate_tasks = dstate_publish(dstate_tasks, now);
+    cost.max_sweep_ns = max(walk_cost.max_sweep_ns, cost.sweep_ns);
+    cost.max_section_ns = max(walk_cost.max_section_ns, cost.section_ns);
+    walk_cost = cost;
+    // A partial census would undercount every state
+    if (complete) {
+        memcpy(task_census, census, sizeof(census));
+        nr_processes = count;
+        walk_threads = 0;
+        for (i = 0; i < NR_CENSUS; i++) {
+            walk_threads += census[i];
+        }
+        if (!io_base_taken) {
+            io_base = live_io;
+            io_base_taken = true;
+        }
+        io_settle(&io_totals, &live_io, &io_base);
+    }
+    if (leak_walk) {
+        nr_leaks = leak_publish(leaks, now);
+    }
+    mutex_unlock(&stats_lock);
+
+    // Blocked tasks are charged to the CPU they last ran on, as the scheduler does
+    if (complete && iowait) {
+        spin_lock(&collector_lock);
+        for_each_cpu(cpu, &collector_cpus) {
+            per_cpu(cpu_collector, cpu).sched.nr_iowait = iowait[cpu];
+        }
+        spin_unlock(&collector_lock);
+    }
+    kfree(iowait);
+
+    if (complete) {
+        track_prune(&process_table, walk_generation);
+        track_prune(&thread_table, walk_generation);
+        group_prune(&session_table, walk_generation);
+        group_prune(&pgrp_table, walk_generation);
+        group_prune(&cgroup_table, walk_generation);
+        group_prune(&uid_table, walk_generation);
+        track_prune(&dstate_table, walk_generation);
+        if (leak_walk) {
+            track_prune(&leak_table, walk_generation);
+        }
+    } else {
+        walk_aborts++;
+    }
+    last_walk_time = now;
+
+    return count;
+}
+
+// Runs in tracepoint context on the current CPU with preemption disabled
+static void task_event_push(int type, struct task_struct *task, pid_t other, u64 cpu_time) {
+    struct task_event_ring *ring = this_cpu_ptr(task_events.rings);
+    u64 head = ring->head;
+    struct task_event *ev = &ring->slots[head % TASK_EVENT_RING];
+
+    WRITE_ONCE(ev->seq, U64_MAX);
+    smp_wmb();
+    ev->timestamp = ktime_get_ns();
+    ev->cpu_time = cpu_time;
+    ev->pid = task->pid;
+    ev->other = other;
+    ev->type = type;
+    memcpy(ev->comm, task->comm, TASK_COMM_LEN);
+    ev->comm[TASK_COMM_LEN - 1] = '\0';
+    smp_wmb();
+    WRITE_ONCE(ev->seq, head);
+    smp_store_release(&ring->head, head + 1);
+
+    if (wq_has_sleeper(&task_events.wait)) {
+        wake_up_interruptible(&task_events.wait);
+    }
+    // A fork storm fills the ring long before the next walk: drain it from a worker
+    if (head + 1 - READ_ONCE(task_events.drain_cursor[smp_processor_id()]) >= TASK_EVENT_HIGH_WATER) {
+        queue_work(system_wq, &task_events.drain_work);
+    }
+}
+
+static void probe_process_fork(void *data, struct task_struct *parent, struct task_struct *child) {
+    if (static_branch_likely(&sched_counters_key)) {
+        this_cpu_inc(cpu_collector.activity.forks);
+    }
+    if (static_branch_likely(&task_events_key)) {
+        task_event_push(TASK_EVENT_FORK, parent, child->pid, 0);
+    }
+}
+
+static void probe_process_exec(void *data, struct task_struct *task, pid_t old_pid, struct linux_binprm *bprm) {
+    if (static_branch_likely(&task_events_key)) {
+        task_event_push(TASK_EVENT_EXEC, task, old_pid, 0);
+    }
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 16, 0)
+static void probe_process_exit(void *data, struct task_struct *task, bool group_dead) {
+#else
+static void probe_process_exit(void *data, struct task_struct *task) {
+#endif
+    if (static_branch_likely(&task_events_key)) {
+        task_event_push(TASK_EVENT_EXIT, task, task->tgid, task->se.sum_exec_runtime);
+    }
+}
+
+// Runs once the task is released and a grace period has passed, possibly from a preemptible
+// RCU callback thread. Its own I/O counters are final by then; reaping only ever copied them.
+static void probe_process_free(void *data, struct task_struct *task) {
+    this_cpu_add(cpu_collector.activity.exited_io.read_bytes, task->ioac.read_bytes);
+    this_cpu_add(cpu_collector.activity.exited_io.write_bytes, task->ioac.write_bytes);
+    this_cpu_add(cpu_collector.activity.exited_io.cancelled_write_bytes, task->ioac.cancelled_write_bytes);
+#ifdef CONFIG_TASK_XACCT
+    this_cpu_add(cpu_collector.activity.exited_io.syscr, task->ioac.syscr);
+    this_cpu_add(cpu_collector.activity.exited_io.syscw, task->ioac.syscw);
+#endif
+}
+
+static void probe_sched_switch(void *data, bool preempt, struct task_struct *prev, struct task_struct *next,
+                               unsigned int prev_state) {
+    if (static_branch_likely(&sched_counters_key)) {
+        this_cpu_inc(cpu_collector.activity.ctx_switches);
+    }
+}
+
+static void probe_nr_running(void *data, struct rq *rq, int change) {
+    if (!static_branch_likely(&sched_counters_key)) return;
+    WRITE_ONCE(per_cpu(cpu_collector, sched_trace_rq_cpu(rq)).activity.nr_running, sched_trace_rq_nr_running(rq));
+}
+
+// sched_waking runs in the waker's context, unlike sched_wakeup, which for a
+// remote wakeup runs on the target CPU. Only registered while tracking is on.
+static void probe_sched_waking(void *data, struct task_struct *p) {
+    struct wakeup_cpu *wc = wakeups.cpus[smp_processor_id()];
+    struct wakeup_table *table;
+    struct wakeup_count key = {};
+    unsigned long flags;
+    unsigned int i;
+
+    if (in_task()) {
+        key.ctx = WAKEUP_TASK;
+        key.waker = current->tgid;
+        memcpy(key.waker_comm, current->comm, TASK_COMM_LEN);
+    } else {
+        key.ctx = in_hardirq() ? WAKEUP_HARDIRQ : WAKEUP_SOFTIRQ;
+    }
+    key.wakee = p->tgid;
+    key.hash = jhash_3words(key.waker, key.wakee, key.ctx, 0);
+
+    // A task waking itself does so with interrupts on, and an interrupt may wake another
+    local_irq_save(flags);
+    table = &wc->tables[wc->active];
+    for (i = 0; i < WAKEUP_PROBES; i++) {
+        struct wakeup_count *c = &table->slots[(key.hash + i) % WAKEUP_CPU_SLOTS];
+
+        if (!c->count) {
+            *c = key;
+            memcpy(c->wakee_comm, p->comm, TASK_COMM_LEN);
+            c->count = 1;
+            break;
+        }
+        if (c->hash == key.hash && c->waker == key.waker && c->wakee == key.wakee && c->ctx == key.ctx) {
+            c->count++;
+            break;
+        }
+    }
+    if (i == WAKEUP_PROBES) {
+        table->dropped++;
+    }
+    local_irq_restore(flags);
+}
+
+// Copy the event at @cursor on @cpu into @out. An event overwritten before or
+// while it was copied is skipped and counted in @lost. Returns false once the
+// reader has caught up with the producer.
+static bool task_event_next(int cpu, u64 *cursor, struct task_event *out, u64 *lost) {
+    struct task_event_ring *ring = per_cpu_ptr(task_events.rings, cpu);
+
+    for (;;) {
+        u64 head = smp_load_acquire(&ring->head);
+        const struct task_event *ev;
+
+        if (*cursor == head) return false;
+        if (head - *cursor > TASK_EVENT_RING) {
+            *lost += head - TASK_EVENT_RING - *cursor;
+            *cursor = head - TASK_EVENT_RING;
+        }
+
+        ev = &ring->slots[*cursor % TASK_EVENT_RING];
+        if (READ_ONCE(ev->seq) == *cursor) {
+            smp_rmb();
+            *out = *ev;
+            smp_rmb();
+            if (READ_ONCE(ev->seq) == *cursor) {
+                (*cursor)++;
+                return true;
+            }
+        }
+        (*lost)++;
+        (*cursor)++;
+    }
+}
+
+static struct comm_track *comm_get(const char *comm, u64 now) {
+    u32 key = jhash(comm, strnlen(comm, TASK_COMM_LEN), 0);
+    struct comm_track *ct;
+
+    hash_for_each_possible(comm_table, ct, node, key) {
+        if (strncmp(ct->comm, comm, TASK_COMM_LEN) == 0) goto found;
+    }
+
+    if (nr_comms >= MAX_TRACKED_COMMS) return NULL;
+    ct = kzalloc(sizeof(*ct), GFP_KERNEL);
+    if (!ct) return NULL;
+    memcpy(ct->comm, comm, TASK_COMM_LEN);
+    hash_add(comm_table, &ct->node, key);
+    nr_comms++;
+
+found:
+    ct->last_active = now;
+    return ct;
+}
+
+// Forget commands idle for COMM_IDLE_MS; 0 forgets all
+static void comm_prune(u64 now) {
+    struct comm_track *ct;
+    struct hlist_node *tmp;
+    int bkt;
+
+    hash_for_each_safe(comm_table, bkt, tmp, ct, node) {
+        if (now && now - ct->last_active < (u64)COMM_IDLE_MS * NSEC_PER_MSEC) continue;
+        hash_del(&ct->node);
+        kfree(ct);
+        nr_comms--;
+    }
+}
+
+// Drain every CPU's ring into the per-command table; caller holds comm_lock
+static void task_events_drain(u64 now) {
+    u64 totals[NR_TASK_EVENTS] = {};
+    struct task_event ev;
+    struct comm_track *ct;
+    u64 cursor, lost = 0;
+    int cpu, i;
+
+    for_each_possible_cpu(cpu) {
+        cursor = task_events.drain_cursor[cpu];
+        while (task_event_next(cpu, &cursor, &ev, &lost)) {
+            totals[ev.type]++;
+            ct = comm_get(ev.comm, now);
+            if (!ct) {
+                comm_untracked++;
+                continue;
+            }
+            if (ev.type == TASK_EVENT_FORK) {
+                ct->forks++;
+            } else if (ev.type == TASK_EVENT_EXEC) {
+                ct->execs++;
+            } else {
+                ct->exits++;
+                ct->exit_cpu += ev.cpu_time;
+            }
+        }
+        WRITE_ONCE(task_events.drain_cursor[cpu], cursor);
+    }
+
+    mutex_lock(&stats_lock);
+    for (i = 0; i < NR_TASK_EVENTS; i++) {
+        task_event_totals[i] += totals[i];
+    }
+    task_events_lost += lost;
+    mutex_unlock(&stats_lock);
+}
+
+// Queued by the probes once a ring is half full
+static void task_events_drain_work(struct work_struct *work) {
+    mutex_lock(&comm_lock);
+    task_events_drain(ktime_get_ns());
+    mutex_unlock(&comm_lock);
+}
+
+// Drain every CPU's ring into the per-command table and publish the busiest spawners
+static void collect_task_events(void) {
+    struct ref_topn top;
+    struct comm_track *ct;
+    u64 now = ktime_get_ns();
+    int bkt, i;
+
+    mutex_lock(&comm_lock);
+    task_events_drain(now);
+
+    ref_topn_reset(&top, MAX_COMMS);
+    hash_for_each(comm_table, bkt, ct, node) {
+        u64 spawns = ct->forks + ct->execs;
+
+        // Events drained after an idle period may date from before it
+        if (walk_baseline) break;
+        if (spawns == ct->last_spawns && ct->exit_cpu == ct->last_exit_cpu) continue;
+        ref_topn_offer(&top, spawns - ct->last_spawns, ct);
+    }
+    ref_topn_sort(&top);
+
+    mutex_lock(&stats_lock);
+    for (i = 0; i < top.count; i++) {
+        struct comm_entry *out = &top_comms[i];
+
+        ct = top.entries[i].ref;
+        memcpy(out->comm, ct->comm, TASK_COMM_LEN);
+        out->forks = ct->forks;
+        out->execs = ct->execs;
+        out->exits = ct->exits;
+        out->exit_cpu = ct->exit_cpu;
+        out->spawn_delta = ct->forks + ct->execs - ct->last_spawns;
+        out->exit_cpu_delta = ct->exit_cpu - ct->last_exit_cpu;
+    }
+    nr_top_comms = top.count;
+    mutex_unlock(&stats_lock);
+
+    hash_for_each(comm_table, bkt, ct, node) {
+        ct->last_spawns = ct->forks + ct->execs;
+        ct->last_exit_cpu = ct->exit_cpu;
+    }
+    comm_prune(now);
+    mutex_unlock(&comm_lock);
+}
+
+// Tracepoints the module hooks. Most are not exported to modules, so they are looked up by name.
+static struct monitor_probe {
+    const char *name;
+    void *func;
+    struct tracepoint *tp;
+} monitor_probes[] = {
+    { "sched_process_fork", probe_process_fork },
+    { "sched_process_exec", probe_process_exec },
+    { "sched_process_exit", probe_process_exit },
+    // Not gated by the idle keys: the system I/O totals need every freed task
+    { "sched_process_free", probe_process_free },
+    { "sched_switch", probe_sched_switch },
+    { "sched_update_nr_running_tp", probe_nr_running },
+};
+
+// Registered only while wakeup tracking is on, so idle systems do not pay for it
+static struct monitor_probe wakeup_probe = { "sched_waking", probe_sched_waking };
+
+static void find_tracepoint(struct tracepoint *tp, void *priv) {
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(monitor_probes); i++) {
+        if (strcmp(tp->name, monitor_probes[i].name) == 0) {
+            monitor_probes[i].tp = tp;
+        }
+    }
+    if (strcmp(tp->name, wakeup_probe.name) == 0) {
+        wakeup_probe.tp = tp;
+    }
+}
+
+static void probes_unregister(int count) {
+    while (count--) {
+        tracepoint_probe_unregister(monitor_probes[count].tp, monitor_probes[count].func, NULL);
+    }
+    tracepoint_synchronize_unregister();
+}
+
+static int probes_register(void) {
+    int i, ret;
+
+    for_each_kernel_tracepoint(find_tracepoint, NULL);
+    for (i = 0; i < ARRAY_SIZE(monitor_probes); i++) {
+        if (!monitor_probes[i].tp) {
+            printk(KERN_ERR "System Monitor: tracepoint %s not found\n", monitor_probes[i].name);
+            ret = -ENOENT;
+            goto err;
+        }
+        ret = tracepoint_probe_register(monitor_probes[i].tp, monitor_probes[i].func, NULL);
+        if (ret) goto err;
+    }
+    return 0;
+
+err:
+    probes_unregister(i);
+    return ret;
+}
+
+// Cumulative since the first complete task walk: the I/O of live threads plus that of
+// every task freed since, less the same sum at the first walk
+static void get_io_stats(struct seq_file *m) {
+    int i;
+
+    mutex_lock(&stats_lock);
+    seq_printf(m, "io_stats:%llu,%llu,%llu,%llu,%llu\n", io_totals.read_bytes, io_totals.write_bytes,
+               io_totals.cancelled_write_bytes, io_totals.syscr, io_totals.syscw);
+    seq_puts(m, "\ntop_io:\n");
+    for (i = 0; i < nr_top_io; i++) {
+        const struct io_entry *e = &top_io[i];
+
+        seq_printf(m, "%d,%s,%llu,%llu,%llu,%llu,%llu\n", e->pid, e->comm, e->rate.read_bytes,
+                   e->rate.write_bytes, e->rate.cancelled_write_bytes, e->rate.syscr, e->rate.syscw);
+    }
+    mutex_unlock(&stats_lock);
+}
+
+static void add_cpu_times(u64 *times, int cpu, int sign) {
+    struct kernel_cpustat kcs;
+    int i;
+
+    // kcpustat_cpu_fetch() adds the running vtime slice on nohz_full CPUs
+    kcpustat_cpu_fetch(&kcs, cpu);
+    for (i = 0; i < NR_CPU_MODES; i++) {
+        times[i] += sign * kcs.cpustat[cpu_mode_index[i]];
+    }
+}
+
+static void read_cpu_times(u64 *times) {
+    int cpu;
+
+    spin_lock(&collector_lock);
+    memcpy(times, collector_retired.cpu_time, sizeof(u64) * NR_CPU_MODES);
+    for_each_cpu(cpu, &collector_cpus) {
+        add_cpu_times(times, cpu, 1);
+    }
+    spin_unlock(&collector_lock);
+}
+
+// Guest time is already part of user and nice time, so it is left out of the total
+static u64 cpu_time_total(const u64 *times) {
+    u64 total = 0;
+    int i;
+
+    for (i = 0; i < CPU_GUEST; i++) {
+        total += times[i];
+    }
+    return total;
+}
+
+static u64 cpu_time_busy(const u64 *times) {
+    return cpu_time_total(times) - times[CPU_IDLE] - times[CPU_IOWAIT];
+}
+
+static void read_network_totals(struct rtnl_link_stats64 *total) {
+    struct net_device *dev;
+
+    memset(total, 0, sizeof(*total));
+    rcu_read_lock();
+    for_each_netdev_rcu(&init_net, dev) {
+        struct rtnl_link_stats64 temp;
+        struct rtnl_link_stats64 *stats = dev_get_stats(dev, &temp);
+
+        total->rx_bytes += stats->rx_bytes;
+        total->tx_bytes += stats->tx_bytes;
+        total->rx_packets += stats->rx_packets;
+        total->tx_packets += stats->tx_packets;
+    }
+    rcu_read_unlock();
+}
+
+static void read_cpu_sched(int cpu, struct sched_counters *c) {
+    const struct cpu_collector *cc = &per_cpu(cpu_collector, cpu);
+    int i;
+
+    c->ctx_switches = READ_ONCE(cc->activity.ctx_switches);
+    c->forks = READ_ONCE(cc->activity.forks);
+    c->nr_running = READ_ONCE(cc->activity.nr_running);
+    c->nr_iowait = cc->sched.nr_iowait;
+    c->irqs = kstat_cpu_irqs_sum(cpu);
+    c->softirqs = 0;
+    for (i = 0; i < NR_SOFTIRQS; i++) {
+        c->softirqs += kstat_softirqs_cpu(i, cpu);
+    }
+}
+
+static void sched_delta(struct sched_counters *delta, const struct sched_counters *cur,
+                        const struct sched_counters *prev) {
+    delta->ctx_switches = cur->ctx_switches - prev->ctx_switches;
+    delta->irqs = cur->irqs - prev->irqs;
+    delta->softirqs = cur->softirqs - prev->softirqs;
+    delta->forks = cur->forks - prev->forks;
+    delta->nr_running = cur->nr_running;
+    delta->nr_iowait = cur->nr_iowait;
+}
+
+// Add (@sign 1) or remove (@sign -1) @c's cumulative counters; gauges only add up
+static void sched_accumulate(struct sched_counters *total, const struct sched_counters *c, int sign) {
+    total->ctx_switches += sign * c->ctx_switches;
+    total->irqs += sign * c->irqs;
+    total->softirqs += sign * c->softirqs;
+    total->forks += sign * c->forks;
+    if (sign > 0) {
+        total->nr_running += c->nr_running;
+        total->nr_iowait += c->nr_iowait;
+    }
+}
+
+// Sum the online CPUs' counters into @total and refresh the published per-CPU deltas
+static void sample_sched(struct sched_counters *total) {
+    u64 start = ktime_get_ns(), cost;
+    int cpu;
+
+    spin_lock(&collector_lock);
+    *total = collector_retired.sched;
+    for_each_cpu(cpu, &collector_cpus) {
+        struct cpu_sched *cs = &per_cpu(cpu_collector, cpu).sched;
+        struct sched_counters cur;
+
+        read_cpu_sched(cpu, &cur);
+        sched_delta(&cs->delta, &cur, &cs->total);
+        cs->total = cur;
+        sched_accumulate(total, &cur, 1);
+    }
+
+    cost = ktime_get_ns() - start;
+    collector_cost.last_ns = cost;
+    collector_cost.max_ns = max(collector_cost.max_ns, cost);
+    spin_unlock(&collector_lock);
+}
+
+// Idle plus iowait time of @cpu in microseconds, counted as /proc/stat does
+static u64 flight_idle_us(unsigned int cpu) {
+    u64 idle = get_cpu_idle_time_us(cpu, NULL);
+    u64 iowait = get_cpu_iowait_time_us(cpu, NULL);
+
+    // Without NO_HZ idle accounting, fall back to the tick-based counters
+    if (idle == -1ULL || iowait == -1ULL) {
+        return div_u64(kcpustat_cpu(cpu).cpustat[CPUTIME_IDLE] + kcpustat_cpu(cpu).cpustat[CPUTIME_IOWAIT],
+                       NSEC_PER_USEC);
+    }
+    return idle + iowait;
+}
+
+// Runs every FLIGHT_PERIOD_MS on its own CPU while the flight recorder is on
+static enum hrtimer_restart flight_tick(struct hrtimer *timer) {
+    struct flight_ring *ring = container_of(timer, struct flight_ring, timer);
+    struct flight_sample *s = &ring->samples[ring->head % FLIGHT_RING];
+    u64 now = ktime_get_ns();
+    u64 idle = flight_idle_us(ring->cpu);
+    u64 elapsed = 0, idle_delta = 0;
+
+    if (ring->last_ns) {
+        elapsed = div_u64(now - ring->last_ns, NSEC_PER_USEC);
+        idle_delta = counter_delta(idle, ring->last_idle_us, false);
+    }
+    s->timestamp = now;
+    s->busy_us = min_t(u64, elapsed > idle_delta ? elapsed - idle_delta : 0, U32_MAX);
+    s->nr_running = READ_ONCE(this_cpu_ptr(&cpu_collector)->activity.nr_running);
+    s->free_pages = global_zone_page_state(NR_FREE_PAGES);
+    ring->last_ns = now;
+    ring->last_idle_us = idle;
+    smp_store_release(&ring->head, ring->head + 1);
+
+    hrtimer_forward_now(timer, ms_to_ktime(FLIGHT_PERIOD_MS));
+    return HRTIMER_RESTART;
+}
+
+// Start recording on the calling CPU; called through on_each_cpu() or from its hotplug callback
+static void flight_cpu_start(void *unused) {
+    struct flight_ring *ring = flight.rings[smp_processor_id()];
+
+    // The first tick after a gap only sets the baseline
+    ring->last_ns = 0;
+    hrtimer_start(&ring->timer, ms_to_ktime(FLIGHT_PERIOD_MS), HRTIMER_MODE_REL_PINNED);
+}
+
+static void flight_free(struct flight_ring **rings) {
+    unsigned int cpu;
+
+    for_each_cpu(cpu, &flight.ring_cpus) {
+        kvfree(rings[cpu]);
+    }
+    kfree(rings);
+    cpumask_clear(&flight.ring_cpus);
+}
+
+// Give @cpu its ring the first time it is online while the recorder is on. The ring
+// is kept when it goes offline, so a recording still covers the time before.
+static int flight_ring_alloc(struct flight_ring **rings, unsigned int cpu) {
+    struct flight_ring *ring;
+
+    if (rings[cpu]) return 0;
+    ring = kvzalloc_node(sizeof(*ring), GFP_KERNEL, cpu_to_node(cpu));
+    if (!ring) return -ENOMEM;
+    ring->cpu = cpu;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&ring->timer, flight_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+#else
+    hrtimer_init(&ring->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+    ring->timer.function = flight_tick;
+#endif
+    WRITE_ONCE(rings[cpu], ring);
+    cpumask_set_cpu(cpu, &flight.ring_cpus);
+    return 0;
+}
+
+// Allocate rings for the online CPUs only and start them; the hotplug callback
+// covers CPUs that come online later
+static int flight_enable(void) {
+    struct flight_ring **rings;
+    unsigned int cpu;
+
+    rings = kcalloc(nr_cpu_ids, sizeof(*rings), GFP_KERNEL);
+    if (!rings) {
+        return -ENOMEM;
+    }
+
+    cpus_read_lock();
+    for_each_online_cpu(cpu) {
+        if (flight_ring_alloc(rings, cpu)) {
+            cpus_read_unlock();
+            flight_free(rings);
+            return -ENOMEM;
+        }
+    }
+    flight.rings = rings;
+    on_each_cpu(flight_cpu_start, NULL, 1);
+    cpus_read_unlock();
+    return 0;
+}
+
+static void flight_disable(void) {
+    struct flight_ring **rings = flight.rings;
+    unsigned int cpu;
+
+    cpus_read_lock();
+    for_each_cpu(cpu, &flight.ring_cpus) {
+        hrtimer_cancel(&rings[cpu]->timer);
+    }
+    flight.rings = NULL;
+    cpus_read_unlock();
+    flight_free(rings);
+}
+
+static bool profile_same(const struct profile_stack *a, const struct profile_stack *b) {
+    return a->hash == b->hash && a->tgid == b->tgid && a->depth == b->depth &&
+           !memcmp(a->ips, b->ips, a->depth * sizeof(a->ips[0]));
+}
+
+// Kernel frames of the interrupted context into @ips, leaf first. The trace also
+// holds the timer interrupt's own frames; they end where the interrupted IP appears.
+static unsigned int profile_kernel_stack(struct pt_regs *regs, unsigned long *ips) {
+    unsigned long trace[PROFILE_TRACE_DEPTH];
+    unsigned long ip = instruction_pointer(regs);
+    unsigned int n = stack_trace_save(trace, ARRAY_SIZE(trace), 0);
+    unsigned int i, depth = 0;
+
+    for (i = 0; i < n; i++) {
+        if (trace[i] == ip) break;
+    }
+    if (i == n) {
+        ips[0] = ip;
+        return 1;
+    }
+    while (i < n && depth < PROFILE_DEPTH) {
+        ips[depth++] = trace[i++];
+    }
+    return depth;
+}
+
+// Count @key in @table, probing a few slots from its hash; a full neighbourhood drops the sample
+static void profile_count(struct profile_table *table, const struct profile_stack *key) {
+    unsigned int i;
+
+    for (i = 0; i < PROFILE_PROBES; i++) {
+        struct profile_stack *s = &table->stacks[(key->hash + i) % PROFILE_CPU_SLOTS];
+
+        if (!s->count) {
+            *s = *key;
+            s->count = 1;
+            return;
+        }
+        if (profile_same(s, key)) {
+            s->count++;
+            return;
+        }
+    }
+    table->dropped++;
+}
+
+// Runs at profile.hz on its own CPU while the profiler is on. Interrupt
+// registers are available without a PMU, as for perf's cpu-clock event.
+static enum hrtimer_restart profile_tick(struct hrtimer *timer) {
+    struct profile_cpu *pc = container_of(timer, struct profile_cpu, timer);
+    struct profile_table *table = &pc->tables[READ_ONCE(pc->active)];
+    struct pt_regs *regs = get_irq_regs();
+    struct profile_stack key = {};
+
+    hrtimer_forward_now(timer, ns_to_ktime(NSEC_PER_SEC / READ_ONCE(profile.hz)));
+    if (!regs) {
+        return HRTIMER_RESTART;
+    }
+
+    if (is_idle_task(current)) {
+        table->idle++;
+        return HRTIMER_RESTART;
+    }
+    if (user_mode(regs)) {
+        key.tgid = current->tgid;
+        memcpy(key.comm, current->comm, TASK_COMM_LEN);
+        key.ips[0] = instruction_pointer(regs);
+        key.depth = 1;
+        table->user++;
+    } else {
+        key.depth = profile_kernel_stack(regs, key.ips);
+        table->kernel++;
+    }
+    key.hash = jhash(key.ips, key.depth * sizeof(key.ips[0]), key.tgid);
+    profile_count(table, &key);
+    return HRTIMER_RESTART;
+}
+
+// Start sampling on the calling CPU; called through on_each_cpu() or from its hotplug callback
+static void profile_cpu_start(void *unused) {
+    struct profile_cpu *pc = profile.cpus[smp_processor_id()];
+
+    hrtimer_start(&pc->timer, ns_to_ktime(NSEC_PER_SEC / READ_ONCE(profile.hz)), HRTIMER_MODE_REL_PINNED_HARD);
+}
+
+static void profile_free(struct profile_cpu **cpus) {
+    unsigned int cpu;
+
+    for_each_cpu(cpu, &profile.table_cpus) {
+        kvfree(cpus[cpu]);
+    }
+    kfree(cpus);
+    cpumask_clear(&profile.table_cpus);
+}
+
+// Give @cpu its tables the first time it is online while the profiler is on. They
+// are kept when it goes offline, so samples not merged yet are not lost.
+static int profile_cpu_alloc(struct profile_cpu **cpus, unsigned int cpu) {
+    struct profile_cpu *pc;
+
+    if (cpus[cpu]) return 0;
+    pc = kvzalloc_node(sizeof(*pc), GFP_KERNEL, cpu_to_node(cpu));
+    if (!pc) return -ENOMEM;
+    // Hard interrupt context even on PREEMPT_RT, where get_irq_regs() is valid
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&pc->timer, profile_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED_HARD);
+#else
+    hrtimer_init(&pc->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED_HARD);
+    pc->timer.function = profile_tick;
+#endif
+    WRITE_ONCE(cpus[cpu], pc);
+    cpumask_set_cpu(cpu, &profile.table_cpus);
+    return 0;
+}
+
+// Allocate tables for the online CPUs only and start them; the hotplug callback
+// covers CPUs that come online later
+static int profile_enable(void) {
+    struct profile_cpu **cpus;
+    unsigned int cpu;
+
+    cpus = kcalloc(nr_cpu_ids, sizeof(*cpus), GFP_KERNEL);
+    if (!cpus) {
+        return -ENOMEM;
+    }
+
+    cpus_read_lock();
+    for_each_online_cpu(cpu) {
+        if (profile_cpu_alloc(cpus, cpu)) {
+            cpus_read_unlock();
+            profile_free(cpus);
+            return -ENOMEM;
+        }
+    }
+    profile.cpus = cpus;
+    on_each_cpu(profile_cpu_start, NULL, 1);
+    cpus_read_unlock();
+    return 0;
+}
+
+// Samples not merged yet are discarded
+static void profile_disable(void) {
+    struct profile_cpu **cpus = profile.cpus;
+    unsigned int cpu;
+
+    cpus_read_lock();
+    for_each_cpu(cpu, &profile.table_cpus) {
+        hrtimer_cancel(&cpus[cpu]->timer);
+    }
+    profile.cpus = NULL;
+    cpus_read_unlock();
+    profile_free(cpus);
+}
+
+// Start sampling @cpu from its current counters; caller holds collector_lock
+static void collector_cpu_start(unsigned int cpu) {
+    struct cpu_sched *cs = &per_cpu(cpu_collector, cpu).sched;
+
+    read_cpu_sched(cpu, &cs->total);
+    memset(&cs->delta, 0, sizeof(cs->delta));
+    cpumask_set_cpu(cpu, &collector_cpus);
+}
+
+// An offline CPU's counters stay frozen: fold them into the retired totals
+// while it is down and take them back out when it returns
+static void collector_retire(unsigned int cpu, int sign) {
+    struct sched_counters c;
+    struct io_usage io;
+
+    read_cpu_sched(cpu, &c);
+    sched_accumulate(&collector_retired.sched, &c, sign);
+    add_cpu_times(collector_retired.cpu_time, cpu, sign);
+    read_cpu_exited_io(cpu, &io);
+    io_accumulate(&collector_retired.exited_io, &io, sign);
+}
+
+static int collector_cpu_online(unsigned int cpu) {
+    spin_lock(&collector_lock);
+    collector_retire(cpu, -1);
+    collector_cpu_start(cpu);
+    spin_unlock(&collector_lock);
+    // Hotplug excludes cpus_read_lock(), so flight.rings and profile.cpus cannot change under us
+    if (flight.rings && !flight_ring_alloc(flight.rings, cpu)) {
+        flight_cpu_start(NULL);
+    }
+    // A CPU whose ring or tables cannot be allocated is left unsampled rather than kept offline
+    if (profile.cpus && !profile_cpu_alloc(profile.cpus, cpu)) {
+        profile_cpu_start(NULL);
+    }
+    return 0;
+}
+
+static int collector_cpu_offline(unsigned int cpu) {
+    if (flight.rings && flight.rings[cpu]) {
+        hrtimer_cancel(&flight.rings[cpu]->timer);
+    }
+    if (profile.cpus && profile.cpus[cpu]) {
+        hrtimer_cancel(&profile.cpus[cpu]->timer);
+    }
+    spin_lock(&collector_lock);
+    cpumask_clear_cpu(cpu, &collector_cpus);
+    per_cpu(cpu_collector, cpu).sched.nr_iowait = 0;
+    WRITE_ONCE(per_cpu(cpu_collector, cpu).activity.nr_running, 0);
+    collector_retire(cpu, 1);
+    spin_unlock(&collector_lock);
+    return 0;
+}
+
+// Possible CPUs are scanned once here; afterwards only hotplug events touch offline CPUs
+static int collector_init(void) {
+    unsigned int cpu;
+    int ret;
+
+    cpus_read_lock();
+    spin_lock(&collector_lock);
+    for_each_possible_cpu(cpu) {
+        if (cpu_online(cpu)) {
+            collector_cpu_start(cpu);
+        } else {
+            collector_retire(cpu, 1);
+        }
+    }
+    spin_unlock(&collector_lock);
+    ret = cpuhp_setup_state_nocalls_cpuslocked(CPUHP_AP_ONLINE_DYN, "system_monitor:online",
+                                               collector_cpu_online, collector_cpu_offline);
+    cpus_read_unlock();
+
+    if (ret < 0) {
+        return ret;
+    }
+    collector_hp_state = ret;
+    return 0;
+}
+
+// Fill @cur from the system counters, using @prev for rates
+static void sample_system(struct monitor_sample *cur, const struct monitor_sample *prev, int process_count) {
+    struct rtnl_link_stats64 net;
+    struct sysinfo si;
+    u64 elapsed, busy, total, available;
+
+    cur->timestamp = ktime_get_ns();
+    elapsed = prev->timestamp ? cur->timestamp - prev->timestamp : 0;
+
+    read_cpu_times(cur->cpu_time);
+    busy = cpu_time_busy(cur->cpu_time) - cpu_time_busy(prev->cpu_time);
+    total = cpu_time_total(cur->cpu_time) - cpu_time_total(prev->cpu_time);
+    cur->metrics[METRIC_CPU] = total ? div64_u64(busy * 100, total) : 0;
+
+    si_meminfo(&si);
+    available = si_mem_available();
+    cur->metrics[METRIC_MEM] = si.totalram ? div64_u64((si.totalram - min_t(u64, available, si.totalram)) * 100, si.totalram) : 0;
+    cur->metrics[METRIC_MEM_AVAIL] = available << (PAGE_SHIFT - 10);
+    cur->metrics[METRIC_PROCS] = process_count;
+
+    read_network_totals(&net);
+    cur->rx_bytes = net.rx_bytes;
+    cur->tx_bytes = net.tx_bytes;
+    cur->metrics[METRIC_NET_RX] = per_second(cur->rx_bytes - prev->rx_bytes, elapsed);
+    cur->metrics[METRIC_NET_TX] = per_second(cur->tx_bytes - prev->tx_bytes, elapsed);
+
+    sample_sched(&cur->sched);
+}
+
+static bool alert_compare(u64 value, int cmp, u64 threshold) {
+    switch (cmp) {
+    case ALERT_GT: return value > threshold;
+    case ALERT_GE: return value >= threshold;
+    case ALERT_LT: return value < threshold;
+    case ALERT_LE: return value <= threshold;
+    }
+    return false;
+}
+
+static void alert_emit(int id, const struct alert_rule *rule) {
+    struct alert_event *ev;
+
+    spin_lock(&alert_events.lock);
+    ev = &alert_events.ring[alert_events.next_seq % ALERT_EVENT_RING];
+    ev->seq = alert_events.next_seq;
+    ev->timestamp_ms = div_u64(ktime_get_real_ns(), NSEC_PER_MSEC);
+    ev->rule = id;
+    ev->metric = rule->metric;
+    ev->cmp = rule->cmp;
+    ev->firing = rule->firing;
+    ev->threshold = rule->threshold;
+    ev->value = rule->value;
+    WRITE_ONCE(alert_events.next_seq, alert_events.next_seq + 1);
+    spin_unlock(&alert_events.lock);
+
+    wake_up_interruptible(&alert_events.wait);
+}
+
+// A rule changes state once its condition has disagreed with it for duration_ms
+static void alert_evaluate(const struct monitor_sample *sample) {
+    int i;
+
+    mutex_lock(&alert_lock);
+    for (i = 0; i < MAX_ALERT_RULES; i++) {
+        struct alert_rule *rule = &alert_rules[i];
+        bool cond;
+
+        if (!rule->active) continue;
+
+        rule->value = sample->metrics[rule->metric];
+        cond = alert_compare(rule->value, rule->cmp, rule->threshold);
+        if (cond == rule->firing) {
+            rule->pending_since = 0;
+            continue;
+        }
+
+        if (!rule->pending_since) {
+            rule->pending_since = sample->timestamp;
+        }
+        if (sample->timestamp - rule->pending_since >= (u64)rule->duration_ms * NSEC_PER_MSEC) {
+            rule->firing = cond;
+            rule->pending_since = 0;
+            alert_emit(i, rule);
+        }
+    }
+    mutex_unlock(&alert_lock);
+}
+
+static bool alerts_active(void) {
+    bool active = false;
+    int i;
+
+    mutex_lock(&alert_lock);
+    for (i = 0; i < MAX_ALERT_RULES && !active; i++) {
+        active = alert_rules[i].active;
+    }
+    mutex_unlock(&alert_lock);
+    return active;
+}
+
+// Open event files and alert rules need data all the time; statistics files
+// count as observed for idle_after_ms after their last open
+static bool monitor_observed(const struct sampling_config *cfg, u64 now) {
+    return atomic_read(&subscribers) || alerts_active() ||
+           now - READ_ONCE(last_read_ns) < (u64)cfg->idle_after_ms * NSEC_PER_MSEC;
+}
+
+// Fold a sample taken @elapsed_ns after the previous one into @am. Returns true once
+// samples have stayed @threshold or more away from the smoothed level, on the same side,
+// for ADAPT_PERSIST_MS. Short intervals see CPU time in whole ticks, so a single sample
+// swinging either way is noise rather than a change.
+static bool adapt_update(struct adapt_metric *am, u64 value, unsigned int threshold, u64 elapsed_ns) {
+    s64 dev = (s64)value * 256 - am->level;
+    s64 limit = (s64)threshold * 256;
+    u64 elapsed_ms = div_u64(elapsed_ns, NSEC_PER_MSEC);
+    int side = dev >= limit ? 1 : dev <= -limit ? -1 : 0;
+
+    am->streak_ns = side && side == am->side ? am->streak_ns + elapsed_ns : side ? elapsed_ns : 0;
+    am->side = side;
+    am->level += div64_s64(dev * (s64)elapsed_ms, elapsed_ms + ADAPT_SMOOTH_MS);
+    return side && am->streak_ns >= ADAPT_PERSIST_MS * NSEC_PER_MSEC;
+}
+
+// Tighten to the minimum interval on a lasting change, otherwise back off towards the maximum
+static unsigned int next_interval(const struct sampling_config *cfg, const struct monitor_sample *cur,
+                                  const struct monitor_sample *prev, unsigned int interval,
+                                  struct adapt_metric *adapt) {
+    bool changed;
+
+    if (!prev->timestamp) {
+        memset(adapt, 0, 2 * sizeof(*adapt));
+        adapt[0].level = (s64)cur->metrics[METRIC_CPU] * 256;
+        adapt[1].level = (s64)cur->metrics[METRIC_MEM] * 256;
+        return cfg->adaptive ? cfg->min_ms : cfg->interval_ms;
+    }
+    // Followed in fixed mode too, so switching to adaptive starts from a current level
+    changed = adapt_update(&adapt[0], cur->metrics[METRIC_CPU], cfg->cpu_delta, cur->timestamp - prev->timestamp);
+    changed |= adapt_update(&adapt[1], cur->metrics[METRIC_MEM], cfg->mem_delta, cur->timestamp - prev->timestamp);
+    if (!cfg->adaptive) {
+        return cfg->interval_ms;
+    }
+    return changed ? cfg->min_ms : clamp(interval * 2, cfg->min_ms, cfg->max_ms);
+}
+
+static void record_history(const struct monitor_sample *cur, const struct monitor_sample *prev, int state) {
+    struct history_entry *entry;
+    u64 total;
+    int i;
+
+    spin_lock(&stats_history.lock);
+    entry = &stats_history.entries[stats_history.head];
+    entry->timestamp = div_u64(cur->timestamp, NSEC_PER_MSEC);
+    entry->interval_ms = prev->timestamp ? div_u64(cur->timestamp - prev->timestamp, NSEC_PER_MSEC) : 0;
+    entry->cpu = cur->metrics[METRIC_CPU];
+    total = cpu_time_total(cur->cpu_time) - cpu_time_total(prev->cpu_time);
+    for (i = 0; i < NR_CPU_MODES; i++) {
+        entry->cpu_split[i] = total ? div64_u64((cur->cpu_time[i] - prev->cpu_time[i]) * 100, total) : 0;
+    }
+    entry->mem_available = cur->metrics[METRIC_MEM_AVAIL];
+    if (prev->timestamp) {
+        sched_delta(&entry->sched, &cur->sched, &prev->sched);
+    } else {
+        memset(&entry->sched, 0, sizeof(entry->sched));
+    }
+    entry->state = state;
+    stats_history.head = (stats_history.head + 1) % HISTORY_SIZE;
+    spin_unlock(&stats_history.lock);
+}
+
+// Entry of the kernel function containing @ip, from its symbol offset; @ip if it has no symbol
+static unsigned long profile_func_start(unsigned long ip) {
+    char sym[KSYM_SYMBOL_LEN];
+    unsigned long offset;
+    char *p, *end;
+
+    sprint_symbol(sym, ip);
+    p = strstr(sym, "+0x");
+    end = p ? strchr(p, '/') : NULL;
+    if (!end) return ip;
+    *end = '\0';
+    if (kstrtoul(p + 3, 16, &offset)) return ip;
+    return ip - offset;
+}
+
+// User-mode samples count against their process, whatever address they hit
+static struct profile_func *profile_func_get(const struct profile_stack *s) {
+    unsigned long start = s->tgid ? 0 : profile_func_start(s->ips[0]);
+    u32 key = hash_long(start, 32) ^ s->tgid;
+    struct profile_func *pf;
+
+    hash_for_each_possible(profile_funcs, pf, node, key) {
+        if (pf->start == start && pf->tgid == s->tgid) return pf;
+    }
+
+    if (profile.nr_funcs >= MAX_PROFILE_FUNCS) return NULL;
+    pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+    if (!pf) return NULL;
+    pf->start = start;
+    pf->tgid = s->tgid;
+    memcpy(pf->comm, s->comm, TASK_COMM_LEN);
+    hash_add(profile_funcs, &pf->node, key);
+    profile.nr_funcs++;
+    return pf;
+}
+
+// Add one per-CPU table entry to the merged counts; symbols are resolved once per new stack
+static void profile_add(const struct profile_stack *s) {
+    struct profile_track *pt;
+
+    hash_for_each_possible(profile_stacks, pt, node, s->hash) {
+        if (profile_same(&pt->stack, s)) goto found;
+    }
+
+    if (profile.nr_stacks >= MAX_PROFILE_STACKS) goto drop;
+    pt = kzalloc(sizeof(*pt), GFP_KERNEL);
+    if (!pt) goto drop;
+    pt->stack = *s;
+    pt->func = profile_func_get(s);
+    if (pt->func) {
+        pt->func->refs++;
+    }
+    hash_add(profile_stacks, &pt->node, s->hash);
+    profile.nr_stacks++;
+
+found:
+    pt->count += s->count;
+    pt->last_merge = profile.merges;
+    if (pt->func) {
+        pt->func->count += s->count;
+    }
+    return;
+
+drop:
+    profile.dropped += s->count;
+}
+
+// Once the merged stacks are three quarters full, forget those without samples in
+// the last PROFILE_COLD_MERGES merges, and functions no remaining stack points to,
+// so a long profile keeps room for the stacks that are hot now
+static void profile_evict(void) {
+    struct profile_track *pt;
+    struct hlist_node *tmp;
+    int bkt;
+
+    if (profile.nr_stacks < MAX_PROFILE_STACKS / 4 * 3) return;
+    hash_for_each_safe(profile_stacks, bkt, tmp, pt, node) {
+        if (profile.merges - pt->last_merge < PROFILE_COLD_MERGES) continue;
+        if (pt->func && !--pt->func->refs) {
+            hash_del(&pt->func->node);
+            kfree(pt->func);
+            profile.nr_funcs--;
+        }
+        hash_del(&pt->node);
+        kfree(pt);
+        profile.nr_stacks--;
+        profile.evicted++;
+    }
+}
+
+// Forget every merged sample; caller holds profile_lock
+static void profile_reset(void) {
+    struct profile_track *pt;
+    struct profile_func *pf;
+    struct hlist_node *tmp;
+    int bkt;
+
+    hash_for_each_safe(profile_stacks, bkt, tmp, pt, node) {
+        hash_del(&pt->node);
+        kfree(pt);
+    }
+    hash_for_each_safe(profile_funcs, bkt, tmp, pf, node) {
+        hash_del(&pf->node);
+        kfree(pf);
+    }
+    profile.kernel = 0;
+    profile.user = 0;
+    profile.idle = 0;
+    profile.dropped = 0;
+    profile.evicted = 0;
+    profile.nr_stacks = 0;
+    profile.nr_funcs = 0;
+    profile.nr_top_funcs = 0;
+    profile.nr_top_stacks = 0;
+}
+
+static void profile_publish(void) {
+    struct ref_topn top;
+    struct profile_track *pt;
+    struct profile_func *pf;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_PROFILE_TOP);
+    hash_for_each(profile_funcs, bkt, pf, node) {
+        ref_topn_offer(&top, pf->count, pf);
+    }
+    ref_topn_sort(&top);
+    for (i = 0; i < top.count; i++) {
+        const struct profile_func *f = top.entries[i].ref;
+        struct profile_func_entry *out = &profile.top_funcs[i];
+
+        out->start = f->start;
+        out->tgid = f->tgid;
+        memcpy(out->comm, f->comm, TASK_COMM_LEN);
+        out->count = f->count;
+    }
+    profile.nr_top_funcs = top.count;
+
+    ref_topn_reset(&top, MAX_PROFILE_TOP);
+    hash_for_each(profile_stacks, bkt, pt, node) {
+        ref_topn_offer(&top, pt->count, pt);
+    }
+    ref_topn_sort(&top);
+    for (i = 0; i < top.count; i++) {
+        const struct profile_track *t = top.entries[i].ref;
+
+        profile.top_stacks[i].stack = t->stack;
+        profile.top_stacks[i].count = t->count;
+    }
+    profile.nr_top_stacks = top.count;
+}
+
+// Fold every CPU's samples into the merged counts, at most once per @interval_ms
+static void profile_merge(unsigned int interval_ms) {
+    u64 now = ktime_get_ns();
+    unsigned int cpu, i;
+
+    mutex_lock(&profile_lock);
+    if (!profile.cpus || now - profile.last_merge < (u64)interval_ms * NSEC_PER_MSEC) {
+        mutex_unlock(&profile_lock);
+        return;
+    }
+    profile.last_merge = now;
+    profile.merges++;
+    profile_evict();
+
+    // Only CPUs that have been online since the profiler was turned on have tables.
+    // One that comes online during the merge is skipped by the first pass, so the
+    // second reads the table it is not writing.
+    for_each_cpu(cpu, &profile.table_cpus) {
+        struct profile_cpu *pc = READ_ONCE(profile.cpus[cpu]);
+
+        if (pc) {
+            WRITE_ONCE(pc->active, !pc->active);
+        }
+    }
+    // Samples are taken in hard interrupt context, so after a grace period no
+    // CPU can still be writing the tables just switched out
+    synchronize_rcu();
+
+    for_each_cpu(cpu, &profile.table_cpus) {
+        struct profile_cpu *pc = READ_ONCE(profile.cpus[cpu]);
+        struct profile_table *table;
+
+        if (!pc) continue;
+        table = &pc->tables[!pc->active];
+        for (i = 0; i < PROFILE_CPU_SLOTS; i++) {
+            if (table->stacks[i].count) {
+                profile_add(&table->stacks[i]);
+            }
+        }
+        profile.kernel += table->kernel;
+        profile.user += table->user;
+        profile.idle += table->idle;
+        profile.dropped += table->dropped;
+        memset(table, 0, sizeof(*table));
+    }
+    profile_publish();
+    mutex_unlock(&profile_lock);
+}
+
+static void wakeup_free(struct wakeup_cpu **cpus) {
+    unsigned int cpu;
+
+    for_each_possible_cpu(cpu) {
+        kvfree(cpus[cpu]);
+    }
+    kfree(cpus);
+}
+
+// Allocate a table pair per possible CPU and hook sched_waking; caller holds wakeup_lock
+static int wakeup_enable(void) {
+    struct wakeup_cpu **cpus;
+    unsigned int cpu;
+    int ret;
+
+    if (!wakeup_probe.tp) {
+        return -ENOENT;
+    }
+    cpus = kcalloc(nr_cpu_ids, sizeof(*cpus), GFP_KERNEL);
+    if (!cpus) {
+        return -ENOMEM;
+    }
+    for_each_possible_cpu(cpu) {
+        cpus[cpu] = kvzalloc_node(sizeof(struct wakeup_cpu), GFP_KERNEL, cpu_to_node(cpu));
+        if (!cpus[cpu]) {
+            wakeup_free(cpus);
+            return -ENOMEM;
+        }
+    }
+
+    WRITE_ONCE(wakeups.cpus, cpus);
+    ret = tracepoint_probe_register(wakeup_probe.tp, wakeup_probe.func, NULL);
+    if (ret) {
+        wakeups.cpus = NULL;
+        wakeup_free(cpus);
+        return ret;
+    }
+    wakeups.last_merge = ktime_get_ns();
+    return 0;
+}
+
+// Samples not merged yet are discarded; caller holds wakeup_lock
+static void wakeup_disable(void) {
+    struct wakeup_cpu **cpus = wakeups.cpus;
+
+    tracepoint_probe_unregister(wakeup_probe.tp, wakeup_probe.func, NULL);
+    tracepoint_synchronize_unregister();
+    wakeups.cpus = NULL;
+    wakeup_free(cpus);
+}
+
+static struct wakeup_track *wakeup_track_get(pid_t tgid, int ctx, const char *comm) {
+    u32 key = jhash_2words(tgid, ctx, 0);
+    struct wakeup_track *wt;
+
+    hash_for_each_possible(wakeup_tracks, wt, node, key) {
+        if (wt->tgid == tgid && wt->ctx == ctx) return wt;
+    }
+
+    if (wakeups.nr_tracked >= MAX_WAKEUP_TRACKED) return NULL;
+    wt = kzalloc(sizeof(*wt), GFP_KERNEL);
+    if (!wt) return NULL;
+    wt->tgid = tgid;
+    wt->ctx = ctx;
+    if (ctx == WAKEUP_TASK) {
+        memcpy(wt->comm, comm, TASK_COMM_LEN);
+    } else {
+        strscpy(wt->comm, wakeup_ctx_names[ctx], TASK_COMM_LEN);
+    }
+    hash_add(wakeup_tracks, &wt->node, key);
+    wakeups.nr_tracked++;
+    return wt;
+}
+
+static int wakeup_publish_top(struct wakeup_entry *out, bool sources, u64 elapsed_ns) {
+    struct wakeup_track *wt;
+    struct ref_topn top;
+    int bkt, i;
+
+    ref_topn_reset(&top, MAX_WAKEUPS);
+    hash_for_each(wakeup_tracks, bkt, wt, node) {
+        u64 count = sources ? wt->caused : wt->woken;
+
+        if (count) {
+            ref_topn_offer(&top, count, wt);
+        }
+    }
+    ref_topn_sort(&top);
+
+    for (i = 0; i < top.count; i++) {
+        const struct wakeup_track *t = top.entries[i].ref;
+
+        out[i].tgid = t->tgid;
+        out[i].ctx = t->ctx;
+        memcpy(out[i].comm, t->comm, TASK_COMM_LEN);
+        out[i].count = top.entries[i].key;
+        out[i].rate = per_second(out[i].count, elapsed_ns);
+    }
+    return top.count;
+}
+
+// Fold every CPU's counts into per-process totals for the interval and publish
+// the busiest wakers and wakees, at most once per @interval_ms. Processes with
+// no wakeups in the interval are forgotten.
+static void wakeup_merge(unsigned int interval_ms) {
+    u64 now = ktime_get_ns(), elapsed;
+    struct wakeup_track *wt;
+    struct hlist_node *tmp;
+    unsigned int cpu, i;
+    int bkt;
+
+    mutex_lock(&wakeup_lock);
+    elapsed = now - wakeups.last_merge;
+    if (!wakeups.cpus || elapsed < (u64)interval_ms * NSEC_PER_MSEC) {
+        mutex_unlock(&wakeup_lock);
+        return;
+    }
+    wakeups.last_merge = now;
+
+    for_each_possible_cpu(cpu) {
+        struct wakeup_cpu *wc = wakeups.cpus[cpu];
+
+        WRITE_ONCE(wc->active, !wc->active);
+    }
+    // The probe runs with preemption disabled, so after a grace period no CPU
+    // can still be writing the tables just switched out
+    synchronize_rcu();
+
+    wakeups.interval_total = 0;
+    for_each_possible_cpu(cpu) {
+        struct wakeup_cpu *wc = wakeups.cpus[cpu];
+        struct wakeup_table *table = &wc->tables[!wc->active];
+
+        for (i = 0; i < WAKEUP_CPU_SLOTS; i++) {
+            const struct wakeup_count *c = &table->slots[i];
+
+            if (!c->count) continue;
+            wakeups.interval_total += c->count;
+            wt = wakeup_track_get(c->waker, c->ctx, c->waker_comm);
+            if (wt) {
+                wt->caused += c->count;
+            }
+            wt = wakeup_track_get(c->wakee, WAKEUP_TASK, c->wakee_comm);
+            if (wt) {
+                wt->woken += c->count;
+            }
+        }
+        wakeups.dropped += table->dropped;
+        memset(table, 0, sizeof(*table));
+    }
+    wakeups.total += wakeups.interval_total;
+    wakeups.rate = per_second(wakeups.interval_total, elapsed);
+
+    wakeups.nr_sources = wakeup_publish_top(wakeups.sources, true, elapsed);
+    wakeups.nr_targets = wakeup_publish_top(wakeups.targets, false, elapsed);
+
+    hash_for_each_safe(wakeup_tracks, bkt, tmp, wt, node) {
+        if (wt->woken || wt->caused) {
+            wt->woken = 0;
+            wt->caused = 0;
+        } else {
+            hash_del(&wt->node);
+            kfree(wt);
+            wakeups.nr_tracked--;
+        }
+    }
+    mutex_unlock(&wakeup_lock);
+}
+
+// Wake the monitor thread early, e.g. after the sampling configuration changed
+static void monitor_wake(void) {
+    WRITE_ONCE(monitor_kick, true);
+    wake_up(&monitor_wait);
+}
+
+// Switch the probes' static keys when the idle mode changes; @applied is the current mode
+static void monitor_probes_set(int idle, int *applied) {
+    // The flight recorder reads run queue lengths even while the monitor is stopped
+    if (idle == IDLE_STOP && READ_ONCE(flight.state) != FLIGHT_OFF) {
+        idle = IDLE_HISTORY;
+    }
+    if (idle == *applied) return;
+    if (idle == IDLE_OFF) {
+        static_branch_enable(&task_events_key);
+    } else {
+        static_branch_disable(&task_events_key);
+    }
+    if (idle == IDLE_STOP) {
+        static_branch_disable(&sched_counters_key);
+    } else {
+        static_branch_enable(&sched_counters_key);
+    }
+    *applied = idle;
+}
+
+// A reader arrived: resume full collection if it was suspended
+static void monitor_touch(void) {
+    WRITE_ONCE(last_read_ns, ktime_get_ns());
+    if (READ_ONCE(monitor_idle)) {
+        monitor_wake();
+    }
+}
+
+static int monitor_function(void *data) {
+    struct monitor_sample prev = {}, cur;
+    struct adapt_metric adapt[2];
+    struct sampling_config cfg;
+    u64 last_walk = 0;
+    int process_count = 0;
+    unsigned int interval = sampling.interval_ms;
+    bool stopped = false;
+    int probe_mode = IDLE_OFF;
+
+    while (!kthread_should_stop()) {
+        bool walked = false;
+        bool halted = false;
+
+        mutex_lock(&sampling_lock);
+        cfg = sampling;
+        mutex_unlock(&sampling_lock);
+
+        if (monitoring == 1) {
+            u64 now = ktime_get_ns();
+            int idle = monitor_observed(&cfg, now) ? IDLE_OFF : cfg.idle_mode;
+
+            if (idle != IDLE_OFF && !monitor_idle) {
+                idle_periods++;
+            }
+            // The first walk after an idle period only re-baselines
+            if (idle == IDLE_OFF && monitor_idle) {
+                walk_baseline = true;
+            }
+            WRITE_ONCE(monitor_idle, idle != IDLE_OFF);
+            monitor_probes_set(idle, &probe_mode);
+
+            // Adaptive mode only speeds up the cheap system-wide counters;
+            // the task walk keeps the base interval
+            if (idle == IDLE_OFF && (!last_walk || now - last_walk >= (u64)cfg.interval_ms * NSEC_PER_MSEC)) {
+                process_count = collect_process_stats();
+                collect_task_events();
+                walk_baseline = false;
+                last_walk = now;
+                walked = true;
+            }
+
+            if (idle == IDLE_STOP) {
+                stopped = true;
+                halted = true;
+                interval = cfg.interval_ms;
+            } else {
+                sample_system(&cur, &prev, process_count);
+                alert_evaluate(&cur);
+                record_history(&cur, &prev, stopped ? HISTORY_GAP : idle ? HISTORY_IDLE : HISTORY_FULL);
+                interval = idle ? cfg.interval_ms : next_interval(&cfg, &cur, &prev, interval, adapt);
+                stopped = false;
+                prev = cur;
+            }
+        } else {
+            // Disabled is not idle: readers must not wait for a sample that never comes
+            WRITE_ONCE(monitor_idle, false);
+            monitor_probes_set(IDLE_OFF, &probe_mode);
+            walk_baseline = true;
+            interval = cfg.interval_ms;
+            // No walk runs while disabled, so mark walk-only views stale here instead:
+            // they also show settings, such as the process rank, that can change meanwhile
+            walked = true;
+        }
+        // Stop mode collects nothing, so it leaves every rendered file current and
+        // sleeps until a reader, an event subscriber or a control write wakes it
+        if (halted) {
+            WRITE_ONCE(current_interval_ms, interval);
+            wait_event_interruptible(monitor_wait, kthread_should_stop() || READ_ONCE(monitor_kick));
+            WRITE_ONCE(monitor_kick, false);
+            continue;
+        }
+        profile_merge(cfg.interval_ms);
+        wakeup_merge(cfg.interval_ms);
+        WRITE_ONCE(current_interval_ms, interval);
+        // Marks every rendered statistics file stale; those of walk results only after a walk
+        if (walked) {
+            WRITE_ONCE(walk_seq, walk_seq + 1);
+        }
+        WRITE_ONCE(sample_seq, sample_seq + 1);
+        if (!READ_ONCE(monitor_idle)) {
+            wake_up_all(&resume_wait);
+        }
+
+        wait_event_interruptible_timeout(monitor_wait, kthread_should_stop() || READ_ONCE(monitor_kick),
+                                         msecs_to_jiffies(interval));
+        WRITE_ONCE(monitor_kick, false);
+    }
+    return 0;
+}
+
+static void timer_callback(struct timer_list *t) {
+    mod_timer(&stats_timer, jiffies + msecs_to_jiffies(1000));
+}
+
+static int lookup_name(const char *name, const char * const *names, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// "alert add <metric> <cmp> <threshold> [duration_ms]", "alert del <id>" or "alert clear"
+static int alert_control(const char *args) {
+    char metric_name[16], cmp_name[3];
+    u64 threshold;
+    u32 duration_ms = 0;
+    int metric, cmp, id, ret = 0;
+
+    if (sscanf(args, "add %15s %2s %llu %u", metric_name, cmp_name, &threshold, &duration_ms) >= 3) {
+        metric = lookup_name(metric_name, metric_names, NR_METRICS);
+        cmp = lookup_name(cmp_name, alert_cmp_names, NR_ALERT_CMPS);
+        if (metric < 0 || cmp < 0) return -EINVAL;
+
+        mutex_lock(&alert_lock);
+        for (id = 0; id < MAX_ALERT_RULES && alert_rules[id].active; id++)
+            ;
+        if (id < MAX_ALERT_RULES) {
+            alert_rules[id] = (struct alert_rule) {
+                .active = true,
+                .metric = metric,
+                .cmp = cmp,
+                .threshold = threshold,
+                .duration_ms = duration_ms,
+            };
+        } else {
+            ret = -ENOSPC;
+        }
+        mutex_unlock(&alert_lock);
+        return ret;
+    }
+
+    if (sscanf(args, "del %d", &id) == 1 || strncmp(args, "clear", 5) == 0) {
+        bool all = strncmp(args, "clear", 5) == 0;
+        int i;
+
+        if (!all && (id < 0 || id >= MAX_ALERT_RULES)) return -EINVAL;
+
+        mutex_lock(&alert_lock);
+        for (i = 0; i < MAX_ALERT_RULES; i++) {
+            struct alert_rule *rule = &alert_rules[i];
+
+            if (!rule->active || (!all && i != id)) continue;
+            // Let listeners know a firing rule will never clear on its own
+            if (rule->firing) {
+                rule->firing = false;
+                alert_emit(i, rule);
+            }
+            rule->active = false;
+        }
+        mutex_unlock(&alert_lock);
+        return 0;
+    }
+
+    return -EINVAL;
+}
+
+// "interval <ms>", "adaptive on|off", "adaptive <min_ms> <max_ms> <cpu_delta> <mem_delta>",
+// "idle off|history|stop" or "idle after <ms>"
+static int sampling_control(char *cmd) {
+    unsigned int a, b, c, d;
+    int ret = 0;
+
+    mutex_lock(&sampling_lock);
+    if (sscanf(cmd, "interval %u", &a) == 1) {
+        if (a >= MIN_INTERVAL_MS && a <= MAX_INTERVAL_MS) {
+            sampling.interval_ms = a;
+        } else {
+            ret = -EINVAL;
+        }
+    } else if (strncmp(cmd, "adaptive on", 11) == 0) {
+        sampling.adaptive = true;
+    } else if (strncmp(cmd, "adaptive off", 12) == 0) {
+        sampling.adaptive = false;
+    } else if (sscanf(cmd, "idle after %u", &a) == 1) {
+        if (a) {
+            sampling.idle_after_ms = a;
+        } else {
+            ret = -EINVAL;
+        }
+    } else if (strncmp(cmd, "idle ", 5) == 0) {
+        int mode = lookup_name(strim(cmd + 5), idle_mode_names, NR_IDLE_MODES);
+
+        if (mode >= 0) {
+            sampling.idle_mode = mode;
+        } else {
+            ret = -EINVAL;
+        }
+    } else if (sscanf(cmd, "adaptive %u %u %u %u", &a, &b, &c, &d) == 4) {
+        if (a >= MIN_INTERVAL_MS && a <= b && b <= MAX_INTERVAL_MS && c && d) {
+            sampling.min_ms = a;
+            sampling.max_ms = b;
+            sampling.cpu_delta = c;
+            sampling.mem_delta = d;
+        } else {
+            ret = -EINVAL;
+        }
+    } else {
+        ret = -EINVAL;
+    }
+    mutex_unlock(&sampling_lock);
+
+    if (!ret) {
+        monitor_wake();
+    }
+    return ret;
+}
+
+// "budget <renders> <window_ms>"
+static int budget_control(const char *args) {
+    unsigned int renders, window_ms;
+
+    if (sscanf(args, "%u %u", &renders, &window_ms) != 2 || !renders ||
+        window_ms < MIN_INTERVAL_MS || window_ms > MAX_INTERVAL_MS) {
+        return -EINVAL;
+    }
+    spin_lock(&render_budget.lock);
+    render_budget.renders = renders;
+    render_budget.window_ms = window_ms;
+    render_budget.used = 0;
+    render_budget.window_start = ktime_get_ns();
+    spin_unlock(&render_budget.lock);
+    return 0;
+}
+
+// "wakeups on|off"
+static int wakeup_control(const char *args) {
+    int ret = 0;
+
+    mutex_lock(&wakeup_lock);
+    if (strncmp(args, "on", 2) == 0) {
+        if (!wakeups.cpus) {
+            ret = wakeup_enable();
+        }
+    } else if (strncmp(args, "off", 3) == 0) {
+        if (wakeups.cpus) {
+            wakeup_disable();
+        }
+    } else {
+        ret = -EINVAL;
+    }
+    mutex_unlock(&wakeup_lock);
+    return ret;
+}
+
+// "profile on|off|reset" and "profile hz <rate>". Turning it on starts a new profile.
+static int profile_control(const char *args) {
+    unsigned int hz;
+    int ret = 0;
+
+    mutex_lock(&profile_lock);
+    if (strncmp(args, "on", 2) == 0) {
+        if (!profile.cpus) {
+            profile_reset();
+            profile.last_merge = ktime_get_ns();
+            ret = profile_enable();
+        }
+    } else if (strncmp(args, "off", 3) == 0) {
+        if (profile.cpus) {
+            profile_disable();
+        }
+    } else if (strncmp(args, "reset", 5) == 0) {
+        profile_reset();
+    } else if (sscanf(args, "hz %u", &hz) == 1) {
+        if (hz && hz <= MAX_PROFILE_HZ) {
+            WRITE_ONCE(profile.hz, hz);
+        } else {
+            ret = -EINVAL;
+        }
+    } else {
+        ret = -EINVAL;
+    }
+    mutex_unlock(&profile_lock);
+    return ret;
+}
+
+// "flight on|off|trigger", "flight window <pre_ms> <post_ms>", and the trigger
+// thresholds "flight cpu <pct>", "flight runq <tasks>" and "flight mem <free_kb>"
+static int flight_control(const char *args) {
+    unsigned int a, b;
+    u64 kb;
+    int ret = 0;
+
+    mutex_lock(&flight_lock);
+    if (strncmp(args, "on", 2) == 0) {
+        if (flight.state == FLIGHT_OFF) {
+            ret = flight_enable();
+            if (!ret) {
+                flight.state = FLIGHT_ARMED;
+                flight.hold = false;
+                queue_delayed_work(system_wq, &flight.work, msecs_to_jiffies(FLIGHT_CHECK_MS));
+            }
+        }
+    } else if (strncmp(args, "off", 3) == 0) {
+        // A pending flight.work sees FLIGHT_OFF and does not requeue
+        if (flight.state != FLIGHT_OFF) {
+            flight.state = FLIGHT_OFF;
+            flight_disable();
+        }
+    } else if (strncmp(args, "trigger", 7) == 0) {
+        if (flight.state == FLIGHT_ARMED) {
+            flight.state = FLIGHT_TRIGGERED;
+            flight.reason = FLIGHT_MANUAL;
+            flight.trigger_ns = ktime_get_ns();
+        } else {
+            ret = flight.state == FLIGHT_OFF ? -EINVAL : -EBUSY;
+        }
+    } else if (sscanf(args, "window %u %u", &a, &b) == 2) {
+        // The whole window must still be in the rings when the post-trigger part ends
+        if (a + b >= FLIGHT_PERIOD_MS && a + b <= (FLIGHT_RING - FLIGHT_MARGIN) * FLIGHT_PERIOD_MS) {
+            flight.pre_ms = a;
+            flight.post_ms = b;
+        } else {
+            ret = -EINVAL;
+        }
+    } else if (sscanf(args, "cpu %u", &a) == 1) {
+        if (a <= 100) {
+            flight.cpu_pct = a;
+        } else {
+            ret = -EINVAL;
+        }
+    } else if (sscanf(args, "runq %u", &a) == 1) {
+        flight.runq = a;
+    } else if (sscanf(args, "mem %llu", &kb) == 1) {
+        flight.mem_kb = kb;
+    } else {
+        ret = -EINVAL;
+    }
+    mutex_unlock(&flight_lock);
+    return ret;
+}
+
+static ssize_t control_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos) {
+    char cmd[CONTROL_BUF_SIZE];
+    size_t len = min(count, sizeof(cmd) - 1);
+    int ret;
+
+    if (copy_from_user(cmd, buffer, len)) {
+        return -EFAULT;
+    }
+
+    cmd[len] = '\0';
+
+    if (strncmp(cmd, "enable", 6) == 0) {
+        monitoring = 1;
+    } else if (strncmp(cmd, "disable", 7) == 0) {
+        monitoring = 0;
+    } else if (strncmp(cmd, "alert ", 6) == 0) {
+        ret = alert_control(cmd + 6);
+        if (ret) return ret;
+    } else if (strncmp(cmd, "threads on", 10) == 0) {
+        WRITE_ONCE(thread_mode, true);
+    } else if (strncmp(cmd, "threads off", 11) == 0) {
+        WRITE_ONCE(thread_mode, false);
+    } else if (strncmp(cmd, "sched_delay on", 14) == 0) {
+        WRITE_ONCE(sched_delay_mode, true);
+    } else if (strncmp(cmd, "sched_delay off", 15) == 0) {
+        WRITE_ONCE(sched_delay_mode, false);
+    } else if (strncmp(cmd, "leak ", 5) == 0) {
+        u64 slope;
+
+        if (kstrtoull(strim(cmd + 5), 10, &slope) || !slope) return -EINVAL;
+        WRITE_ONCE(leak_min_slope, slope);
+    } else if (strncmp(cmd, "dstate ", 7) == 0) {
+        unsigned int ms;
+
+        if (kstrtouint(strim(cmd + 7), 10, &ms) || !ms) return -EINVAL;
+        WRITE_ONCE(dstate_min_ms, ms);
+    } else if (strncmp(cmd, "rank ", 5) == 0) {
+        ret = lookup_name(strim(cmd + 5), rank_names, NR_RANKS);
+        if (ret < 0) return -EINVAL;
+        WRITE_ONCE(process_rank, ret);
+    } else if (strncmp(cmd, "interval ", 9) == 0 || strncmp(cmd, "adaptive ", 9) == 0 ||
+               strncmp(cmd, "idle ", 5) == 0) {
+        ret = sampling_control(cmd);
+        if (ret) return ret;
+    } else if (strncmp(cmd, "budget ", 7) == 0) {
+        ret = budget_control(cmd + 7);
+        if (ret) return ret;
+    } else if (strncmp(cmd, "flight ", 7) == 0) {
+        ret = flight_control(cmd + 7);
+        if (ret) return ret;
+    } else if (strncmp(cmd, "profile ", 8) == 0) {
+        ret = profile_control(cmd + 8);
+        if (ret) return ret;
+    } else if (strncmp(cmd, "wakeups ", 8) == 0) {
+        ret = wakeup_control(cmd + 8);
+        if (ret) return ret;
+    }
+
+    // A stopped monitor only wakes when told to, and the command may change what it collects
+    if (READ_ONCE(monitor_idle)) {
+        monitor_wake();
+    }
+    return count;
+}
+
+static bool events_pending(const u64 *cursor) {
+    return READ_ONCE(alert_events.next_seq) != *cursor || READ_ONCE(alert_events.shutdown);
+}
+
+static int events_open(struct inode *inode, struct file *file) {
+    u64 *cursor = kmalloc(sizeof(*cursor), GFP_KERNEL);
+
+    if (!cursor) {
+        return -ENOMEM;
+    }
+
+    // Readers only see events raised after they opened the file
+    spin_lock(&alert_events.lock);
+    *cursor = alert_events.next_seq;
+    spin_unlock(&alert_events.lock);
+
+    file->private_data = cursor;
+    atomic_inc(&subscribers);
+    monitor_touch();
+    return nonseekable_open(inode, file);
+}
+
+// Shared by both event files
+static int events_release(struct inode *inode, struct file *file) {
+    kfree(file->private_data);
+    atomic_dec(&subscribers);
+    return 0;
+}
+
+// Blocks until at least one event is available, then returns whole lines only
+static ssize_t events_read(struct file *file, char __user *buffer, size_t count, loff_t *ppos) {
+    u64 *cursor = file->private_data;
+    size_t len = 0;
+    char *kbuf;
+    ssize_t ret;
+
+    if (!events_pending(cursor)) {
+        if (file->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
+        }
+        ret = wait_event_interruptible(alert_events.wait, events_pending(cursor));
+        if (ret) {
+            return ret;
+        }
+    }
+    if (READ_ONCE(alert_events.shutdown)) {
+        return 0;
+    }
+
+    count = min_t(size_t, count, PAGE_SIZE);
+    kbuf = kmalloc(count, GFP_KERNEL);
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+
+    spin_lock(&alert_events.lock);
+    if (alert_events.next_seq - *cursor > ALERT_EVENT_RING) {
+        u64 oldest = alert_events.next_seq - ALERT_EVENT_RING;
+        char line[ALERT_LINE_SIZE];
+        int n = scnprintf(line, sizeof(line), "lost:%llu\n", oldest - *cursor);
+
+        if (n <= count) {
+            memcpy(kbuf, line, n);
+            len = n;
+        }
+        *cursor = oldest;
+    }
+    while (*cursor != alert_events.next_seq) {
+        const struct alert_event *ev = &alert_events.ring[*cursor % ALERT_EVENT_RING];
+        char line[ALERT_LINE_SIZE];
+        int n = scnprintf(line, sizeof(line), "alert:%llu,%llu,%d,%s,%s,%llu,%s,%llu\n",
+                          ev->seq, ev->timestamp_ms, ev->rule, metric_names[ev->metric],
+                          alert_cmp_names[ev->cmp], ev->threshold, ev->firing ? "firing" : "cleared", ev->value);
+
+        if (len + n > count) break;
+        memcpy(kbuf + len, line, n);
+        len += n;
+        (*cursor)++;
+    }
+    spin_unlock(&alert_events.lock);
+
+    if (!len) {
+        ret = -EINVAL;
+    } else if (copy_to_user(buffer, kbuf, len)) {
+        ret = -EFAULT;
+    } else {
+        ret = len;
+    }
+    kfree(kbuf);
+    return ret;
+}
+
+static __poll_t events_poll(struct file *file, poll_table *wait) {
+    u64 *cursor = file->private_data;
+
+    poll_wait(file, &alert_events.wait, wait);
+    return events_pending(cursor) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static bool task_events_pending(const struct task_event_reader *reader) {
+    int cpu;
+
+    if (READ_ONCE(task_events.shutdown)) return true;
+    for_each_possible_cpu(cpu) {
+        if (smp_load_acquire(&per_cpu_ptr(task_events.rings, cpu)->head) != reader->cursor[cpu]) return true;
+    }
+    return false;
+}
+
+static int task_events_open(struct inode *inode, struct file *file) {
+    struct task_event_reader *reader = kzalloc(struct_size(reader, cursor, nr_cpu_ids), GFP_KERNEL);
+    int cpu;
+
+    if (!reader) {
+        return -ENOMEM;
+    }
+
+    // Readers only see events raised after they opened the file
+    for_each_possible_cpu(cpu) {
+        reader->cursor[cpu] = smp_load_acquire(&per_cpu_ptr(task_events.rings, cpu)->head);
+    }
+
+    file->private_data = reader;
+    atomic_inc(&subscribers);
+    monitor_touch();
+    return nonseekable_open(inode, file);
+}
+
+// Blocks until at least one event is available, then returns whole lines only.
+// Events are ordered per CPU; the timestamps allow merging across CPUs.
+static ssize_t task_events_read(struct file *file, char __user *buffer, size_t count, loff_t *ppos) {
+    struct task_event_reader *reader = file->private_data;
+    struct task_event ev;
+    char line[TASK_EVENT_LINE_SIZE];
+    size_t len = 0;
+    char *kbuf;
+    ssize_t ret;
+    int cpu, n;
+
+    if (!task_events_pending(reader)) {
+        if (file->f_flags & O_NONBLOCK) {
+            return -EAGAIN;
+        }
+        ret = wait_event_interruptible(task_events.wait, task_events_pending(reader));
+        if (ret) {
+            return ret;
+        }
+    }
+    if (READ_ONCE(task_events.shutdown)) {
+        return 0;
+    }
+
+    count = min_t(size_t, count, PAGE_SIZE);
+    kbuf = kmalloc(count, GFP_KERNEL);
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+
+    for_each_possible_cpu(cpu) {
+        for (;;) {
+            u64 cursor = reader->cursor[cpu];
+            u64 lost = reader->lost;
+
+            if (!task_event_next(cpu, &cursor, &ev, &lost)) {
+                reader->cursor[cpu] = cursor;
+                reader->lost = lost;
+                break;
+            }
+            if (lost) {
+                n = scnprintf(line, sizeof(line), "lost:%llu\n", lost);
+                if (len + n > count) goto out;
+                memcpy(kbuf + len, line, n);
+                len += n;
+                // The loss is reported: resume at the event just read, whether or not it fits
+                reader->cursor[cpu] = cursor - 1;
+                reader->lost = 0;
+            }
+            n = scnprintf(line, sizeof(line), "%s:%llu,%d,%d,%d,%llu,%s\n", task_event_names[ev.type],
+                          ev.timestamp, cpu, ev.pid, ev.other, ev.cpu_time, ev.comm);
+            if (len + n > count) goto out;
+            memcpy(kbuf + len, line, n);
+            len += n;
+            reader->cursor[cpu] = cursor;
+        }
+    }
+
+out:
+    if (!len) {
+        ret = -EINVAL;
+    } else if (copy_to_user(buffer, kbuf, len)) {
+        ret = -EFAULT;
+    } else {
+        ret = len;
+    }
+    kfree(kbuf);
+    return ret;
+}
+
+static __poll_t task_events_poll(struct file *file, poll_table *wait) {
+    struct task_event_reader *reader = file->private_data;
+
+    poll_wait(file, &task_events.wait, wait);
+    return task_events_pending(reader) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static void show_sampling(struct seq_file *m) {
+    struct sampling_config cfg;
+
+    mutex_lock(&sampling_lock);
+    cfg = sampling;
+    mutex_unlock(&sampling_lock);
+
+    seq_printf(m, "sampling:%s,%u,%u,%u,%u\n", cfg.adaptive ? "adaptive" : "fixed",
+               READ_ONCE(current_interval_ms), cfg.interval_ms, cfg.min_ms, cfg.max_ms);
+    seq_printf(m, "idle:%s,%u,%d,%d,%u\n", idle_mode_names[cfg.idle_mode], cfg.idle_after_ms,
+               READ_ONCE(monitor_idle), atomic_read(&subscribers), READ_ONCE(idle_periods));
+}
+
+static void show_reads(struct seq_file *m) {
+    unsigned int renders, window_ms;
+
+    spin_lock(&render_budget.lock);
+    renders = render_budget.renders;
+    window_ms = render_budget.window_ms;
+    spin_unlock(&render_budget.lock);
+
+    seq_printf(m, "stats_reads:%lld,%lld,%lld,%lld,%u,%u\n", atomic64_read(&read_counters.opens),
+               atomic64_read(&read_counters.cached), atomic64_read(&read_counters.throttled),
+               atomic64_read(&read_counters.renders), renders, window_ms);
+}
+
+// Newest entry first; the rollup weights each entry by the interval it covers
+static void show_history(struct seq_file *m) {
+    u64 window = 0, cpu_weighted = 0, mem_min = 0;
+    int i, mode;
+
+    spin_lock(&stats_history.lock);
+    for (i = 0; i < HISTORY_SIZE; i++) {
+        const struct history_entry *entry = &stats_history.entries[i];
+
+        if (!entry->interval_ms) continue;
+        window += entry->interval_ms;
+        cpu_weighted += (u64)entry->cpu * entry->interval_ms;
+        if (!mem_min || entry->mem_available < mem_min) mem_min = entry->mem_available;
+    }
+    seq_printf(m, "history_rollup:%llu,%llu,%llu\n", window, window ? div64_u64(cpu_weighted, window) : 0, mem_min);
+
+    seq_puts(m, "history:\n");
+    for (i = 0; i < HISTORY_SIZE; i++) {
+        int idx = (stats_history.head - i - 1 + HISTORY_SIZE) % HISTORY_SIZE;
+        const struct history_entry *entry = &stats_history.entries[idx];
+
+        if (!entry->timestamp) break;
+        seq_printf(m, "%d,%llu,%u,%u,%llu,%llu,%llu,%llu,%llu,%u,%u", i, entry->timestamp, entry->interval_ms,
+                   entry->cpu, entry->mem_available, entry->sched.ctx_switches, entry->sched.irqs,
+                   entry->sched.softirqs, entry->sched.forks, entry->sched.nr_running, entry->sched.nr_iowait);
+        for (mode = 0; mode < NR_CPU_MODES; mode++) {
+            seq_printf(m, ",%u", entry->cpu_split[mode]);
+        }
+        seq_printf(m, ",%u\n", entry->state);
+    }
+    spin_unlock(&stats_history.lock);
+}
+
+static void show_flight(struct seq_file *m) {
+    mutex_lock(&flight_lock);
+    seq_printf(m, "flight:%s,%u,%u,%u,%u,%llu,%u\n", flight_state_names[flight.state], flight.pre_ms, flight.post_ms,
+               flight.cpu_pct, flight.runq, flight.mem_kb, flight.dumps);
+    mutex_unlock(&flight_lock);
+}
+
+static void show_profile(struct seq_file *m) {
+    int i, j;
+
+    mutex_lock(&profile_lock);
+    seq_printf(m, "profile:%s,%u,%llu,%llu,%llu,%llu,%u,%llu\n", profile.cpus ? "on" : "off", profile.hz,
+               profile.kernel, profile.user, profile.idle, profile.dropped, profile.nr_stacks, profile.evicted);
+    seq_puts(m, "\nprofile_functions:\n");
+    for (i = 0; i < profile.nr_top_funcs; i++) {
+        const struct profile_func_entry *f = &profile.top_funcs[i];
+
+        if (f->tgid) {
+            seq_printf(m, "%llu,[user] %s/%d\n", f->count, f->comm, f->tgid);
+        } else {
+            seq_printf(m, "%llu,%ps\n", f->count, (void *)f->start);
+        }
+    }
+    // Folded stacks, root first. Outer frames are return addresses, so their
+    // call site is looked up one byte earlier. User addresses are left raw.
+    seq_puts(m, "\nprofile_stacks:\n");
+    for (i = 0; i < profile.nr_top_stacks; i++) {
+        const struct profile_stack *s = &profile.top_stacks[i].stack;
+
+        seq_printf(m, "%llu,", profile.top_stacks[i].count);
+        if (s->tgid) {
+            seq_printf(m, "[user] %s/%d;0x%lx\n", s->comm, s->tgid, s->ips[0]);
+            continue;
+        }
+        for (j = s->depth - 1; j >= 0; j--) {
+            seq_printf(m, "%s%ps", j == s->depth - 1 ? "" : ";", (void *)(s->ips[j] - (j ? 1 : 0)));
+        }
+        seq_putc(m, '\n');
+    }
+    mutex_unlock(&profile_lock);
+}
+
+static void show_sched(struct seq_file *m) {
+    struct sched_counters total;
+    int cpu;
+
+    spin_lock(&collector_lock);
+    total = collector_retired.sched;
+    for_each_cpu(cpu, &collector_cpus) {
+        sched_accumulate(&total, &per_cpu(cpu_collector, cpu).sched.total, 1);
+    }
+    seq_printf(m, "sched_stats:%llu,%llu,%llu,%llu,%u,%u\n", total.ctx_switches, total.irqs, total.softirqs,
+               total.forks, total.nr_running, total.nr_iowait);
+    seq_printf(m, "collector:%u,%llu,%llu\n", cpumask_weight(&collector_cpus), collector_cost.last_ns,
+               collector_cost.max_ns);
+
+    seq_puts(m, "\ncpu_activity:\n");
+    for_each_cpu(cpu, &collector_cpus) {
+        const struct sched_counters *d = &per_cpu(cpu_collector, cpu).sched.delta;
 
-static struct proc_dir_entry *proc_entry;
-static struct proc_dir_entry *control_entry;
-static struct timer_list stats_timer;
-static struct task_struct *monitor_thread;
-static int monitoring = 1;
-static struct process_stats top_processes[MAX_PROCESSES];
+        seq_printf(m, "%d,%llu,%llu,%llu,%llu,%u,%u\n", cpu, d->ctx_switches, d->irqs, d->softirqs, d->forks,
+                   d->nr_running, d->nr_iowait);
+    }
+    spin_unlock(&collector_lock);
+}
 
-static void collect_process_stats(void) {
-    struct task_struct *task;
-    int i = 0;
+static void show_top_processes(struct seq_file *m) {
+    int i;
 
-    rcu_read_lock();
-    for_each_process(task) {
-        if (i >= MAX_PROCESSES) break;
+    mutex_lock(&stats_lock);
+    seq_printf(m, "task_tracking:%u,%u,%u,%u\n", process_table.count, thread_table.count,
+               process_table.untracked + thread_table.untracked, walk_aborts);
+    seq_printf(m, "task_walk:%llu,%llu,%llu,%llu,%u,%llu\n", walk_cost.sweep_ns, walk_cost.max_sweep_ns,
+               walk_cost.section_ns, walk_cost.max_section_ns, walk_cost.sections, walk_cost.pause_ns);
+    seq_printf(m, "process_rank:%s\n", rank_names[READ_ONCE(process_rank)]);
+    seq_puts(m, "\ntop_processes:\n");
+    for (i = 0; i < nr_top_processes; i++) {
+        const struct process_stats *ps = &top_processes[i];
+        const struct mem_usage *mem = &ps->mem;
 
-        struct process_stats *stats = &top_processes[i];
-        stats->pid = task->pid;
-        stats->cpu_time = task->utime + task->stime;
+        seq_printf(m, "%d,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%lld\n", ps->pid, ps->comm, ps->cpu_time,
+                   mem->anon + mem->file + mem->shmem, ps->cpu_delta, mem->anon, mem->file, mem->shmem,
+                   mem->swap, mem->rss_growth);
+    }
 
-        if (task->mm) {
-            stats->vm_size = task->mm->total_vm << PAGE_SHIFT;
-        } else {
-            stats->vm_size = 0;
+    if (READ_ONCE(thread_mode)) {
+        seq_puts(m, "\ntop_threads:\n");
+        for (i = 0; i < nr_top_threads; i++) {
+            const struct process_stats *ts = &top_threads[i];
+
+            seq_printf(m, "%d,%d,%s,%llu,%llu\n", ts->pid, ts->tgid, ts->comm, ts->cpu_time, ts->cpu_delta);
         }
+    }
+    mutex_unlock(&stats_lock);
+}
+
+static void show_groups(struct seq_file *m, const char *name, const struct group_entry *groups, int count) {
+    int i;
+
+    seq_printf(m, "\n%s:\n", name);
+    for (i = 0; i < count; i++) {
+        const struct group_entry *g = &groups[i];
 
-        get_task_comm(stats->comm, task);
-        i++;
+        seq_printf(m, "%llu,%s,%u,%llu,%llu,%llu\n", g->id, g->comm, g->stats.nr_tasks,
+                   g->stats.cpu_delta, g->stats.rss, g->stats.io_delta);
     }
-    rcu_read_unlock();
 }
 
-static void get_io_stats(struct seq_file *m) {
-    struct task_struct *task;
-    unsigned long read_bytes = 0, write_bytes = 0;
+static void show_process_tree(struct seq_file *m) {
+    int i;
 
-    rcu_read_lock();
-    for_each_process(task) {
-        if (task->ioac.read_bytes) {
-            read_bytes += task->ioac.read_bytes;
-        }
-        if (task->ioac.write_bytes) {
-            write_bytes += task->ioac.write_bytes;
-        }
+    mutex_lock(&stats_lock);
+    seq_puts(m, "\nprocess_tree:\n");
+    for (i = 0; i < nr_tree_nodes; i++) {
+        const struct tree_node *n = &process_tree[i];
+
+        seq_printf(m, "%d,%d,%d,%s,%llu,%llu,%llu,%llu,%u\n", n->pid, n->ppid, n->depth, n->comm, n->cpu_delta,
+                   n->subtree.cpu_delta, n->subtree.rss, n->subtree.io_delta, n->subtree.nr_tasks);
     }
-    rcu_read_unlock();
+    show_groups(m, "sessions", top_sessions, nr_top_sessions);
+    show_groups(m, "process_groups", top_pgrps, nr_top_pgrps);
+    mutex_unlock(&stats_lock);
+}
 
-    seq_printf(m, "io_stats:%lu,%lu\n", read_bytes, write_bytes);
+static void show_cgroups(struct seq_file *m) {
+    int i;
+
+    mutex_lock(&stats_lock);
+    seq_puts(m, "\ncgroups:\n");
+    for (i = 0; i < nr_top_cgroups; i++) {
+        const struct cgroup_entry *c = &top_cgroups[i];
+        const struct group_stats *g = &c->group.stats;
+
+        seq_printf(m, "%llu,%s,%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", c->group.id, c->path,
+                   g->nr_tasks, g->cpu_delta, g->rss, g->io_delta, c->nr_throttled, c->throttled_usec,
+                   c->mem_high, c->mem_max, c->mem_oom, c->mem_oom_kill);
+    }
+    mutex_unlock(&stats_lock);
 }
 
-static int monitor_function(void *data) {
-    while (!kthread_should_stop()) {
-        if (monitoring == 1) {
-            collect_process_stats();
+static void show_users(struct seq_file *m) {
+    int i;
 
-            spin_lock(&stats_history.lock);
-            stats_history.cpu_usage[stats_history.head] = get_jiffies_64();
-            stats_history.mem_usage[stats_history.head] = si_mem_available();
-            stats_history.head = (stats_history.head + 1) % HISTORY_SIZE;
-            spin_unlock(&stats_history.lock);
-        }
-        msleep(1000);
+    mutex_lock(&stats_lock);
+    seq_puts(m, "\nusers:\n");
+    for (i = 0; i < nr_top_uids; i++) {
+        const struct group_entry *u = &top_uids[i];
+
+        seq_printf(m, "%llu,%u,%llu,%llu,%llu\n", u->id, u->stats.nr_tasks, u->stats.cpu_delta,
+                   u->stats.rss, u->stats.io_delta);
     }
-    return 0;
+    mutex_unlock(&stats_lock);
 }
 
-static void timer_callback(struct timer_list *t) {
-    mod_timer(&stats_timer, jiffies + msecs_to_jiffies(1000));
+static void show_delayed(struct seq_file *m) {
+    int i;
+
+    mutex_lock(&stats_lock);
+    seq_puts(m, "\nsched_delay:\n");
+    for (i = 0; i < nr_top_delayed; i++) {
+        const struct delay_entry *d = &top_delayed[i];
+
+        seq_printf(m, "%d,%s,%llu,%llu,%llu\n", d->pid, d->comm, d->run_delay_delta, d->pcount_delta,
+                   d->cpu_delta);
+    }
+    mutex_unlock(&stats_lock);
 }
 
-static ssize_t control_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos) {
-    char cmd[32];
-    size_t len = min(count, sizeof(cmd) - 1);
+static void show_dstate(struct seq_file *m) {
+    int i;
 
-    if (copy_from_user(cmd, buffer, len)) {
-        return -EFAULT;
+    mutex_lock(&stats_lock);
+    seq_printf(m, "dstate_tracking:%u,%u,%u\n", dstate_table.count, dstate_table.untracked,
+               READ_ONCE(dstate_min_ms));
+    seq_puts(m, "\ndstate:\n");
+    for (i = 0; i < nr_dstate_tasks; i++) {
+        const struct dstate_entry *d = &dstate_tasks[i];
+
+        seq_printf(m, "%d,%d,%s,%llu\n", d->pid, d->tgid, d->comm, d->wait_ms);
     }
+    mutex_unlock(&stats_lock);
+}
 
-    cmd[len] = '\0';
+static void show_wakeup_rows(struct seq_file *m, const char *name, const struct wakeup_entry *rows, int count) {
+    int i;
 
-    if (strncmp(cmd, "enable", 6) == 0) {
-        monitoring = 1;
-    } else if (strncmp(cmd, "disable", 7) == 0) {
-        monitoring = 0;
+    seq_printf(m, "\n%s:\n", name);
+    for (i = 0; i < count; i++) {
+        seq_printf(m, "%d,%s,%llu,%llu\n", rows[i].tgid, rows[i].comm, rows[i].rate, rows[i].count);
     }
+}
 
-    return count;
+static void show_wakeups(struct seq_file *m) {
+    mutex_lock(&wakeup_lock);
+    seq_printf(m, "wakeups:%s,%llu,%llu,%llu,%u\n", wakeups.cpus ? "on" : "off", wakeups.rate, wakeups.total,
+               wakeups.dropped, wakeups.nr_tracked);
+    show_wakeup_rows(m, "wakeup_sources", wakeups.sources, wakeups.nr_sources);
+    show_wakeup_rows(m, "wakeup_targets", wakeups.targets, wakeups.nr_targets);
+    mutex_unlock(&wakeup_lock);
 }
 
-static void show_history(struct seq_file *m) {
+static void show_leaks(struct seq_file *m) {
     int i;
-    spin_lock(&stats_history.lock);
-    seq_puts(m, "history:\n");
-    for (i = 0; i < HISTORY_SIZE; i++) {
-        int idx = (stats_history.head - i - 1 + HISTORY_SIZE) % HISTORY_SIZE;
-        seq_printf(m, "%d,%llu,%llu\n", i, stats_history.cpu_usage[idx], stats_history.mem_usage[idx]);
+
+    mutex_lock(&stats_lock);
+    seq_printf(m, "leak_tracking:%u,%u,%llu\n", leak_table.count, leak_table.untracked, READ_ONCE(leak_min_slope));
+    seq_puts(m, "\nleaks:\n");
+    for (i = 0; i < nr_leaks; i++) {
+        const struct leak_entry *l = &leaks[i];
+
+        seq_printf(m, "%d,%s,%llu,%lld,%u,%llu\n", l->pid, l->comm, l->rss, l->slope, l->rising_ms, l->oom_ms);
     }
-    spin_unlock(&stats_history.lock);
+    mutex_unlock(&stats_lock);
 }
 
-static void show_top_processes(struct seq_file *m) {
+static void show_task_events(struct seq_file *m) {
     int i;
-    seq_puts(m, "\ntop_processes:\n");
-    for (i = 0; i < MAX_PROCESSES; i++) {
-        if (top_processes[i].pid == 0) break;
-        seq_printf(m, "%d,%s,%llu,%lu\n", top_processes[i].pid, top_processes[i].comm, top_processes[i].cpu_time, top_processes[i].vm_size);
+
+    mutex_lock(&stats_lock);
+    seq_printf(m, "task_events:%llu,%llu,%llu,%llu,%llu\n", task_event_totals[TASK_EVENT_FORK],
+               task_event_totals[TASK_EVENT_EXEC], task_event_totals[TASK_EVENT_EXIT], task_events_lost,
+               comm_untracked);
+    seq_puts(m, "\nspawns:\n");
+    for (i = 0; i < nr_top_comms; i++) {
+        const struct comm_entry *c = &top_comms[i];
+
+        seq_printf(m, "%s,%llu,%llu,%llu,%llu,%llu,%llu\n", c->comm, c->forks, c->execs, c->exits,
+                   c->exit_cpu, c->spawn_delta, c->exit_cpu_delta);
     }
+    mutex_unlock(&stats_lock);
 }
 
-static void get_cpu_stats(struct seq_file *m) {
-    int cpu;
-    u64 user = 0, nice = 0, system = 0, idle = 0;
+static void show_alerts(struct seq_file *m) {
+    int i;
 
-    for_each_possible_cpu(cpu) {
-        struct kernel_cpustat *kcs = &kcpustat_cpu(cpu);
-        user += kcs->cpustat[VTIME_USER];
-        nice += kcs->cpustat[CPUTIME_NICE];
-        system += kcs->cpustat[VTIME_SYS];
-        idle += kcs->cpustat[VTIME_IDLE];
+    seq_puts(m, "\nalerts:\n");
+    mutex_lock(&alert_lock);
+    for (i = 0; i < MAX_ALERT_RULES; i++) {
+        const struct alert_rule *rule = &alert_rules[i];
+
+        if (!rule->active) continue;
+        seq_printf(m, "%d,%s,%s,%llu,%u,%s,%llu\n", i, metric_names[rule->metric], alert_cmp_names[rule->cmp],
+                   rule->threshold, rule->duration_ms, rule->firing ? "firing" : "ok", rule->value);
     }
+    mutex_unlock(&alert_lock);
+}
+
+static void get_cpu_stats(struct seq_file *m) {
+    u64 times[NR_CPU_MODES];
+    int i;
 
-    seq_printf(m, "cpu_stats:%llu,%llu,%llu,%llu\n", user, nice, system, idle);
+    read_cpu_times(times);
+    seq_puts(m, "cpu_stats:");
+    for (i = 0; i < NR_CPU_MODES; i++) {
+        seq_printf(m, i ? ",%llu" : "%llu", times[i]);
+    }
+    seq_putc(m, '\n');
 }
 
 static void get_memory_stats(struct seq_file *m) {
@@ -180,36 +4458,21 @@ static void get_memory_stats(struct seq_file *m) {
     seq_printf(m, "memory_stats:%lu,%lu,%lu\n", si.totalram << (PAGE_SHIFT - 10), si.freeram << (PAGE_SHIFT - 10), (si.totalram - si.freeram) << (PAGE_SHIFT - 10));
 }
 
+// Counted by the last complete task walk
 static void get_process_count(struct seq_file *m) {
-    struct task_struct *task;
-    int count = 0;
-
-    rcu_read_lock();
-    for_each_process(task) {
-        count++;
-    }
-    rcu_read_unlock();
-
-    seq_printf(m, "process_count:%d\n", count);
+    mutex_lock(&stats_lock);
+    seq_printf(m, "process_count:%d\n", nr_processes);
+    seq_printf(m, "task_states:%u,%u,%u,%u,%u,%u\n", task_census[CENSUS_RUNNING],
+               task_census[CENSUS_INTERRUPTIBLE], task_census[CENSUS_UNINTERRUPTIBLE],
+               task_census[CENSUS_STOPPED], task_census[CENSUS_ZOMBIE], task_census[CENSUS_IDLE]);
+    mutex_unlock(&stats_lock);
 }
 
 static void get_network_stats(struct seq_file *m) {
-    struct net_device *dev;
-    unsigned long rx_bytes = 0, tx_bytes = 0, rx_packets = 0, tx_packets = 0;
-
-    rcu_read_lock();
-    for_each_netdev_rcu(&init_net, dev) {
-        struct rtnl_link_stats64 temp;
-        struct rtnl_link_stats64 *stats = dev_get_stats(dev, &temp);
-
-        rx_bytes += stats->rx_bytes;
-        tx_bytes += stats->tx_bytes;
-        rx_packets += stats->rx_packets;
-        tx_packets += stats->tx_packets;
-    }
-    rcu_read_unlock();
+    struct rtnl_link_stats64 total;
 
-    seq_printf(m, "network_stats:%lu,%lu,%lu,%lu\n", rx_bytes, tx_bytes, rx_packets, tx_packets);
+    read_network_totals(&total);
+    seq_printf(m, "network_stats:%llu,%llu,%llu,%llu\n", total.rx_bytes, total.tx_bytes, total.rx_packets, total.tx_packets);
 }
 
 static int system_stats_show(struct seq_file *m, void *v) {
@@ -218,33 +4481,520 @@ static int system_stats_show(struct seq_file *m, void *v) {
     get_process_count(m);
     get_io_stats(m);
     get_network_stats(m);
+    show_sampling(m);
+    show_reads(m);
+    show_sched(m);
+    show_profile(m);
     show_history(m);
+    show_flight(m);
+    show_top_processes(m);
+    show_process_tree(m);
+    show_cgroups(m);
+    show_users(m);
+    show_dstate(m);
+    show_delayed(m);
+    show_wakeups(m);
+    show_leaks(m);
+    show_task_events(m);
+    show_alerts(m);
+    return 0;
+}
+
+static int cpu_stats_show(struct seq_file *m, void *v) {
+    get_cpu_stats(m);
+    show_sched(m);
+    show_profile(m);
+    return 0;
+}
+
+static int memory_stats_show(struct seq_file *m, void *v) {
+    get_memory_stats(m);
+    show_leaks(m);
+    return 0;
+}
+
+static int network_stats_show(struct seq_file *m, void *v) {
+    get_network_stats(m);
+    return 0;
+}
+
+static int io_stats_show(struct seq_file *m, void *v) {
+    get_io_stats(m);
+    return 0;
+}
+
+static int process_stats_show(struct seq_file *m, void *v) {
+    get_process_count(m);
     show_top_processes(m);
+    show_process_tree(m);
+    show_cgroups(m);
+    show_users(m);
+    show_dstate(m);
+    show_delayed(m);
+    show_wakeups(m);
+    show_task_events(m);
+    return 0;
+}
+
+static int history_stats_show(struct seq_file *m, void *v) {
+    show_sampling(m);
+    show_history(m);
+    show_flight(m);
+    return 0;
+}
+
+static struct stats_view stats_views[] = {
+    { .name = "cpu", .show = cpu_stats_show },
+    { .name = "memory", .show = memory_stats_show },
+    { .name = "net", .show = network_stats_show },
+    { .name = "io", .show = io_stats_show, .per_walk = true },
+    { .name = "processes", .show = process_stats_show, .per_walk = true },
+    { .name = "history", .show = history_stats_show },
+    { .name = "all", .show = system_stats_show },
+};
+
+static void snapshot_put(struct stats_snapshot *snap) {
+    // A reader may still be in refcount_inc_not_zero() until a grace period passes
+    if (refcount_dec_and_test(&snap->refs)) {
+        kvfree_rcu(snap, rcu);
+    }
+}
+
+// Take one rendering from the current budget window; false once it is used up
+static bool render_budget_take(void) {
+    u64 now = ktime_get_ns();
+    bool ok;
+
+    spin_lock(&render_budget.lock);
+    if (now - render_budget.window_start >= (u64)render_budget.window_ms * NSEC_PER_MSEC) {
+        render_budget.window_start = now;
+        render_budget.used = 0;
+    }
+    ok = render_budget.used < render_budget.renders;
+    if (ok) {
+        render_budget.used++;
+    }
+    spin_unlock(&render_budget.lock);
+    return ok;
+}
+
+// Sequence number the latest rendering of @view is compared against
+static u64 view_seq(const struct stats_view *view) {
+    return view->per_walk ? READ_ONCE(walk_seq) : READ_ONCE(sample_seq);
+}
+
+// Render @view for sample @seq and publish it; caller holds view->render_lock
+static int snapshot_render(struct stats_view *view, u64 seq) {
+    struct stats_snapshot *snap, *old;
+    struct seq_file m = {};
+
+    for (;;) {
+        snap = kvmalloc(struct_size(snap, data, view->size), GFP_KERNEL);
+        if (!snap) {
+            return -ENOMEM;
+        }
+        m.buf = snap->data;
+        m.size = view->size;
+        m.count = 0;
+        view->show(&m, NULL);
+        if (!seq_has_overflowed(&m)) break;
+
+        kvfree(snap);
+        if (view->size >= SNAPSHOT_MAX_SIZE) {
+            return -E2BIG;
+        }
+        view->size *= 2;
+    }
+
+    snap->len = m.count;
+    snap->seq = seq;
+    refcount_set(&snap->refs, 1);
+    atomic64_inc(&read_counters.renders);
+
+    old = rcu_replace_pointer(view->snapshot, snap, lockdep_is_held(&view->render_lock));
+    if (old) {
+        snapshot_put(old);
+    }
     return 0;
 }
 
+// The open file keeps the view's rendering of the latest sample, so every read of one
+// open file sees the same consistent sample. Only the first opener after a sample renders,
+// and only while the render budget lasts; past it, openers get the last rendering.
 static int system_stats_open(struct inode *inode, struct file *file) {
-    return single_open(file, system_stats_show, NULL);
+    struct stats_view *view = pde_data(inode);
+    struct stats_snapshot *snap;
+    int ret = 0;
+    u64 seq;
+
+    // The first reader after an idle period waits for a full sample, up to IDLE_RESUME_MS
+    seq = READ_ONCE(sample_seq);
+    monitor_touch();
+    if (READ_ONCE(monitor_idle)) {
+        wait_event_interruptible_timeout(resume_wait, READ_ONCE(sample_seq) != seq && !READ_ONCE(monitor_idle),
+                                         msecs_to_jiffies(IDLE_RESUME_MS));
+    }
+    seq = view_seq(view);
+
+    atomic64_inc(&read_counters.opens);
+    rcu_read_lock();
+    do {
+        snap = rcu_dereference(view->snapshot);
+    } while (snap && !refcount_inc_not_zero(&snap->refs));
+    rcu_read_unlock();
+
+    if (snap && snap->seq == seq) {
+        atomic64_inc(&read_counters.cached);
+    } else {
+        if (snap) {
+            snapshot_put(snap);
+        }
+        mutex_lock(&view->render_lock);
+        snap = rcu_dereference_protected(view->snapshot, lockdep_is_held(&view->render_lock));
+        if (snap && snap->seq == seq) {
+            atomic64_inc(&read_counters.cached);
+        } else if (snap && !render_budget_take()) {
+            atomic64_inc(&read_counters.throttled);
+        } else {
+            // A view that was never rendered is always rendered
+            ret = snapshot_render(view, seq);
+            snap = rcu_dereference_protected(view->snapshot, lockdep_is_held(&view->render_lock));
+        }
+        // Only render_lock holders replace the view's reference, so it keeps snap alive here
+        if (!ret) {
+            refcount_inc(&snap->refs);
+        }
+        mutex_unlock(&view->render_lock);
+        if (ret) {
+            return ret;
+        }
+    }
+    file->private_data = snap;
+    return 0;
+}
+
+static ssize_t system_stats_read(struct file *file, char __user *buffer, size_t count, loff_t *ppos) {
+    const struct stats_snapshot *snap = file->private_data;
+
+    return simple_read_from_buffer(buffer, count, ppos, snap->data, snap->len);
+}
+
+static int system_stats_release(struct inode *inode, struct file *file) {
+    snapshot_put(file->private_data);
+    return 0;
+}
+
+// Drop the renderings kept by the views and the flight recording; open files keep their own references
+static void stats_views_release(void) {
+    struct stats_snapshot *snap;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(stats_views); i++) {
+        snap = rcu_replace_pointer(stats_views[i].snapshot, NULL, true);
+        if (snap) {
+            snapshot_put(snap);
+        }
+    }
+    snap = rcu_replace_pointer(flight.dump, NULL, true);
+    if (snap) {
+        snapshot_put(snap);
+    }
+}
+
+// The threshold crossed over the last FLIGHT_CHECK_MS, or -1. CPU busy time is
+// summed over all online CPUs; run queues and free memory are the latest samples.
+static int flight_threshold(u64 now) {
+    u64 since = now - FLIGHT_CHECK_MS * NSEC_PER_MSEC;
+    u64 busy = 0, elapsed = 0, newest = 0;
+    unsigned long free_pages = 0;
+    unsigned int nr_running = 0;
+    unsigned int cpu;
+
+    for_each_online_cpu(cpu) {
+        const struct flight_ring *ring = READ_ONCE(flight.rings[cpu]);
+        u64 head, pos;
+
+        if (!ring) continue;
+        head = smp_load_acquire(&ring->head);
+        for (pos = head; pos > 0 && head - pos < FLIGHT_RING - FLIGHT_MARGIN; pos--) {
+            const struct flight_sample *s = &ring->samples[(pos - 1) % FLIGHT_RING];
+
+            if (s->timestamp < since) break;
+            if (pos == head) {
+                nr_running += s->nr_running;
+                if (s->timestamp > newest) {
+                    newest = s->timestamp;
+                    free_pages = s->free_pages;
+                }
+            }
+            busy += s->busy_us;
+            elapsed += FLIGHT_PERIOD_MS * USEC_PER_MSEC;
+        }
+    }
+
+    if (!elapsed) return -1;
+    if (flight.cpu_pct && busy * 100 >= elapsed * flight.cpu_pct) return FLIGHT_CPU;
+    if (flight.runq && nr_running >= flight.runq) return FLIGHT_RUNQ;
+    if (flight.mem_kb && ((u64)free_pages << (PAGE_SHIFT - 10)) < flight.mem_kb) return FLIGHT_MEM;
+    return -1;
+}
+
+// Fold every CPU's samples taken in [start, start + nslots periods) into @slots
+static void flight_collect(struct flight_slot *slots, int nslots, u64 start) {
+    unsigned int cpu;
+    int i;
+
+    for (i = 0; i < nslots; i++) {
+        slots[i].busiest_cpu = -1;
+        slots[i].free_pages = ULONG_MAX;
+    }
+    // Rings of CPUs that went offline during the window still hold its start
+    for_each_cpu(cpu, &flight.ring_cpus) {
+        const struct flight_ring *ring = READ_ONCE(flight.rings[cpu]);
+        u64 head, pos;
+
+        if (!ring) continue;
+        head = smp_load_acquire(&ring->head);
+        for (pos = head; pos > 0 && head - pos < FLIGHT_RING - FLIGHT_MARGIN; pos--) {
+            const struct flight_sample *s = &ring->samples[(pos - 1) % FLIGHT_RING];
+            struct flight_slot *slot;
+
+            if (s->timestamp < start) break;
+            i = div64_u64(s->timestamp - start, FLIGHT_PERIOD_MS * NSEC_PER_MSEC);
+            if (i >= nslots) continue;
+
+            slot = &slots[i];
+            slot->busy_us += s->busy_us;
+            slot->nr_running += s->nr_running;
+            slot->samples++;
+            slot->free_pages = min(slot->free_pages, s->free_pages);
+            if (slot->busiest_cpu < 0 || s->busy_us > slot->max_busy_us) {
+                slot->max_busy_us = s->busy_us;
+                slot->busiest_cpu = cpu;
+            }
+        }
+    }
+}
+
+// Render the recording around the trigger and publish it as the flight file.
+// Its size is bounded by the window, not by the number of CPUs. Caller holds flight_lock.
+static int flight_freeze(void) {
+    int nslots = (flight.pre_ms + flight.post_ms) / FLIGHT_PERIOD_MS;
+    u64 pre_ns = (u64)flight.pre_ms * NSEC_PER_MSEC;
+    u64 start = flight.trigger_ns > pre_ns ? flight.trigger_ns - pre_ns : 0;
+    u64 period_us = FLIGHT_PERIOD_MS * USEC_PER_MSEC;
+    size_t size = SNAPSHOT_MIN_SIZE + (size_t)nslots * FLIGHT_ROW_SIZE;
+    struct stats_snapshot *snap, *old;
+    struct flight_slot *slots;
+    struct seq_file m = {};
+    int i;
+
+    slots = kvcalloc(nslots, sizeof(*slots), GFP_KERNEL);
+    snap = kvmalloc(struct_size(snap, data, size), GFP_KERNEL);
+    if (!slots || !snap) {
+        kvfree(slots);
+        kvfree(snap);
+        return -ENOMEM;
+    }
+    flight_collect(slots, nslots, start);
+
+    m.buf = snap->data;
+    m.size = size;
+    seq_printf(&m, "flight_dump:%u,%s,%llu,%u,%u,%u,%u\n", flight.dumps + 1, flight_trigger_names[flight.reason],
+               div_u64(flight.trigger_ns, NSEC_PER_MSEC), flight.pre_ms, flight.post_ms, FLIGHT_PERIOD_MS,
+               num_online_cpus());
+    // offset_ms,busy_pct,max_cpu_busy_pct,busiest_cpu,nr_running,free_kb; empty slices are left out
+    seq_puts(&m, "\nflight_samples:\n");
+    for (i = 0; i < nslots; i++) {
+        const struct flight_slot *slot = &slots[i];
+
+        if (!slot->samples) continue;
+        seq_printf(&m, "%lld,%llu,%llu,%d,%u,%lu\n",
+                   div_s64(start + (u64)i * FLIGHT_PERIOD_MS * NSEC_PER_MSEC - flight.trigger_ns, NSEC_PER_MSEC),
+                   min_t(u64, div64_u64(slot->busy_us * 100, slot->samples * period_us), 100),
+                   min_t(u64, div64_u64((u64)slot->max_busy_us * 100, period_us), 100),
+                   slot->busiest_cpu, slot->nr_running, slot->free_pages << (PAGE_SHIFT - 10));
+    }
+    kvfree(slots);
+    if (seq_has_overflowed(&m)) {
+        kvfree(snap);
+        return -E2BIG;
+    }
+
+    snap->len = m.count;
+    snap->seq = ++flight.dumps;
+    refcount_set(&snap->refs, 1);
+    old = rcu_replace_pointer(flight.dump, snap, lockdep_is_held(&flight_lock));
+    if (old) {
+        snapshot_put(old);
+    }
+    return 0;
+}
+
+// Runs every FLIGHT_CHECK_MS while the flight recorder is on. A threshold fires
+// once when crossed and re-arms only after it clears, so a sustained spike keeps
+// the dump of its onset instead of replacing it every window.
+static void flight_check(struct work_struct *work) {
+    u64 now = ktime_get_ns();
+    int reason;
+
+    mutex_lock(&flight_lock);
+    if (flight.state == FLIGHT_ARMED) {
+        reason = flight_threshold(now);
+        if (reason < 0) {
+            flight.hold = false;
+        } else if (!flight.hold) {
+            flight.hold = true;
+            flight.state = FLIGHT_TRIGGERED;
+            flight.reason = reason;
+            flight.trigger_ns = now;
+        }
+    }
+    if (flight.state == FLIGHT_TRIGGERED && now - flight.trigger_ns >= (u64)flight.post_ms * NSEC_PER_MSEC) {
+        // A recording that cannot be saved is dropped; the recorder re-arms either way
+        flight_freeze();
+        flight.state = FLIGHT_ARMED;
+    }
+    if (flight.state != FLIGHT_OFF) {
+        queue_delayed_work(system_wq, &flight.work, msecs_to_jiffies(FLIGHT_CHECK_MS));
+    }
+    mutex_unlock(&flight_lock);
+}
+
+// The flight file serves the last frozen recording, which never changes once published
+static int flight_open(struct inode *inode, struct file *file) {
+    struct stats_snapshot *snap;
+
+    rcu_read_lock();
+    do {
+        snap = rcu_dereference(flight.dump);
+    } while (snap && !refcount_inc_not_zero(&snap->refs));
+    rcu_read_unlock();
+
+    if (!snap) {
+        return -ENODATA;
+    }
+    file->private_data = snap;
+    return 0;
+}
+
+// Turn the recorder off and wait out its work; only at module exit
+static void flight_shutdown(void) {
+    mutex_lock(&flight_lock);
+    if (flight.state != FLIGHT_OFF) {
+        flight.state = FLIGHT_OFF;
+        flight_disable();
+    }
+    mutex_unlock(&flight_lock);
+    cancel_delayed_work_sync(&flight.work);
 }
 
 static const struct proc_ops system_stats_fops = {
     .proc_open = system_stats_open,
-    .proc_read = seq_read,
-    .proc_lseek = seq_lseek,
-    .proc_release = single_release,
+    .proc_read = system_stats_read,
+    .proc_lseek = default_llseek,
+    .proc_release = system_stats_release,
+};
+static const struct proc_ops flight_fops = {
+    .proc_open = flight_open,
+    .proc_read = system_stats_read,
+    .proc_lseek = default_llseek,
+    .proc_release = system_stats_release,
 };
 static const struct proc_ops control_fops = {
     .proc_write = control_write,
 };
+static const struct proc_ops events_fops = {
+    .proc_open = events_open,
+    .proc_read = events_read,
+    .proc_poll = events_poll,
+    .proc_release = events_release,
+};
+static const struct proc_ops task_events_fops = {
+    .proc_open = task_events_open,
+    .proc_read = task_events_read,
+    .proc_poll = task_events_poll,
+    .proc_release = events_release,
+};
 
 static int __init system_monitor_init(void) {
+    int ret, i;
+
     spin_lock_init(&stats_history.lock);
     stats_history.head = 0;
+    spin_lock_init(&alert_events.lock);
+    init_waitqueue_head(&alert_events.wait);
+    init_waitqueue_head(&task_events.wait);
+    INIT_DELAYED_WORK(&flight.work, flight_check);
+    INIT_WORK(&task_events.drain_work, task_events_drain_work);
+    hash_init(session_table.buckets);
+    hash_init(pgrp_table.buckets);
+    hash_init(cgroup_table.buckets);
+    hash_init(uid_table.buckets);
+
+    process_table.size = sizeof(struct process_track);
+    process_table.cache = KMEM_CACHE(process_track, 0);
+    thread_table.size = sizeof(struct thread_track);
+    thread_table.cache = KMEM_CACHE(thread_track, 0);
+    leak_table.size = sizeof(struct leak_track);
+    leak_table.cache = KMEM_CACHE(leak_track, 0);
+    dstate_table.size = sizeof(struct dstate_track);
+    dstate_table.cache = KMEM_CACHE(dstate_track, 0);
+    process_table.max = MAX_TRACKED_TASKS;
+    thread_table.max = MAX_TRACKED_TASKS;
+    leak_table.max = MAX_LEAK_TRACKED;
+    dstate_table.max = MAX_DSTATE_TRACKED;
+    if (!process_table.cache || !thread_table.cache || !leak_table.cache || !dstate_table.cache ||
+        track_table_alloc(&process_table) || track_table_alloc(&thread_table) ||
+        track_table_alloc(&leak_table) || track_table_alloc(&dstate_table)) {
+        ret = -ENOMEM;
+        goto err_cache;
+    }
+
+    task_events.rings = alloc_percpu(struct task_event_ring);
+    task_events.drain_cursor = kcalloc(nr_cpu_ids, sizeof(u64), GFP_KERNEL);
+    if (!task_events.rings || !task_events.drain_cursor) {
+        ret = -ENOMEM;
+        goto err_rings;
+    }
+
+    ret = collector_init();
+    if (ret) {
+        goto err_rings;
+    }
+    // Loading the module counts as a read, so collection starts out active
+    last_read_ns = ktime_get_ns();
+
+    proc_dir = proc_mkdir(PROC_NAME, NULL);
+    if (!proc_dir) {
+        ret = -ENOMEM;
+        goto err_proc;
+    }
+    for (i = 0; i < ARRAY_SIZE(stats_views); i++) {
+        struct stats_view *view = &stats_views[i];
 
-    proc_entry = proc_create(PROC_NAME, 0444, NULL, &system_stats_fops);
+        mutex_init(&view->render_lock);
+        view->size = SNAPSHOT_MIN_SIZE;
+        if (!proc_create_data(view->name, 0444, proc_dir, &system_stats_fops, view)) {
+            ret = -ENOMEM;
+            goto err_proc;
+        }
+    }
+    if (!proc_create("flight", 0444, proc_dir, &flight_fops)) {
+        ret = -ENOMEM;
+        goto err_proc;
+    }
     control_entry = proc_create(PROC_CONTROL, 0222, NULL, &control_fops);
-    if (!proc_entry || !control_entry) {
-        return -ENOMEM;
+    events_entry = proc_create(PROC_EVENTS, 0444, NULL, &events_fops);
+    task_events_entry = proc_create(PROC_TASK_EVENTS, 0444, NULL, &task_events_fops);
+    if (!control_entry || !events_entry || !task_events_entry) {
+        ret = -ENOMEM;
+        goto err_proc;
+    }
+
+    ret = probes_register();
+    if (ret) {
+        goto err_proc;
     }
 
     timer_setup(&stats_timer, timer_callback, 0);
@@ -252,18 +5002,92 @@ static int __init system_monitor_init(void) {
 
     monitor_thread = kthread_run(monitor_function, NULL, "system_monitor");
     if (IS_ERR(monitor_thread)) {
-        return PTR_ERR(monitor_thread);
+        ret = PTR_ERR(monitor_thread);
+        goto err_thread;
     }
 
     printk(KERN_INFO "System Monitor Module loaded\n");
     return 0;
+
+err_thread:
+    del_timer_sync(&stats_timer);
+    probes_unregister(ARRAY_SIZE(monitor_probes));
+    cancel_work_sync(&task_events.drain_work);
+err_proc:
+    proc_remove(proc_dir);
+    proc_remove(control_entry);
+    proc_remove(events_entry);
+    proc_remove(task_events_entry);
+    stats_views_release();
+    cpuhp_remove_state_nocalls(collector_hp_state);
+err_rings:
+    free_percpu(task_events.rings);
+    kfree(task_events.drain_cursor);
+err_cache:
+    kmem_cache_destroy(process_table.cache);
+    kmem_cache_destroy(thread_table.cache);
+    kmem_cache_destroy(leak_table.cache);
+    kmem_cache_destroy(dstate_table.cache);
+    kvfree(process_table.buckets);
+    kvfree(thread_table.buckets);
+    kvfree(leak_table.buckets);
+    kvfree(dstate_table.buckets);
+    return ret;
 }
 
 static void __exit system_monitor_exit(void) {
     del_timer_sync(&stats_timer);
     kthread_stop(monitor_thread);
-    proc_remove(proc_entry);
+    if (!IS_ERR_OR_NULL(cgroup_mnt)) {
+        kern_unmount(cgroup_mnt);
+    }
+    flight_shutdown();
+    mutex_lock(&profile_lock);
+    if (profile.cpus) {
+        profile_disable();
+    }
+    profile_reset();
+    mutex_unlock(&profile_lock);
+    mutex_lock(&wakeup_lock);
+    if (wakeups.cpus) {
+        wakeup_disable();
+    }
+    mutex_unlock(&wakeup_lock);
+    probes_unregister(ARRAY_SIZE(monitor_probes));
+    cancel_work_sync(&task_events.drain_work);
+    cpuhp_remove_state_nocalls(collector_hp_state);
+
+    // Release blocked event readers so the proc entries can be removed
+    WRITE_ONCE(alert_events.shutdown, true);
+    wake_up_interruptible_all(&alert_events.wait);
+    WRITE_ONCE(task_events.shutdown, true);
+    wake_up_interruptible_all(&task_events.wait);
+
+    proc_remove(proc_dir);
     proc_remove(control_entry);
+    proc_remove(events_entry);
+    proc_remove(task_events_entry);
+    stats_views_release();
+    free_percpu(task_events.rings);
+    kfree(task_events.drain_cursor);
+
+    track_prune(&process_table, 0);
+    track_prune(&thread_table, 0);
+    track_prune(&leak_table, 0);
+    track_prune(&dstate_table, 0);
+    group_prune(&session_table, 0);
+    group_prune(&pgrp_table, 0);
+    group_prune(&cgroup_table, 0);
+    group_prune(&uid_table, 0);
+    comm_prune(0);
+    kmem_cache_destroy(process_table.cache);
+    kmem_cache_destroy(thread_table.cache);
+    kmem_cache_destroy(leak_table.cache);
+    kmem_cache_destroy(dstate_table.cache);
+    kvfree(process_table.buckets);
+    kvfree(thread_table.buckets);
+    kvfree(leak_table.buckets);
+    kvfree(dstate_table.buckets);
     printk(KERN_INFO "System Monitor Module unloaded\n");
 }
 
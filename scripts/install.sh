@@ -79,5 +79,5 @@ systemctl start system-monitor
 echo -e "\n${GREEN}Installation complete!${NC}"
 echo -e "You can now:"
 echo -e "1. Run '${YELLOW}system_monitor_display${NC}' to start the display program"
-echo -e "2. Check '${YELLOW}cat /proc/system_monitor${NC}' for raw stats"
+echo -e "2. Check '${YELLOW}cat /proc/system_monitor/all${NC}' for raw stats"
 echo -e "3. View service status with '${YELLOW}systemctl status system-monitor${NC}'"
@@ -2,24 +2,201 @@
  * System Monitor Display Program
  *
  * This program reads system statistics from the kernel module through /proc
- * and displays them in a user-friendly ncurses interface.
+ * and displays them in a user-friendly ncurses interface. With --export it
+ * runs headless instead and serves the statistics as OpenMetrics text.
+ * Pressing 't' switches to a collapsible process tree with per-session and
+ * per-process-group totals, 'u' to the busiest users, 'p' to the functions
+ * the kernel profiler sampled most, and 'f' to the last flight recording.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <ncurses.h>
 #include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pwd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 /* Constants */
-#define PROC_FILE "/proc/system_monitor"
+#define PROC_FILE "/proc/system_monitor/all"
+#define PROC_FLIGHT "/proc/system_monitor/flight"
 #define BUFFER_SIZE 4096
 #define MAX_DISKS 16
+#define DISPLAY_INTERVAL_MS 500
+#define STATS_RING_SIZE 8
+#define MAX_TREE_NODES 64
+#define MAX_GROUPS 20
+#define GROUP_ROWS 5
+#define COMM_LEN 16
+#define CPU_BAR_WIDTH 50
+#define MAX_FLIGHT_ROWS 1024
+#define MAX_PROFILE_FUNCS 20
+#define PROFILE_NAME_LEN 64
+#define USER_NAME_CACHE 64
+#define FLIGHT_CHART_ROWS 16
+
+/* Exporter constants */
+#define EXPORT_DEFAULT_HOST "127.0.0.1"
+#define EXPORT_INTERVAL_MS 1000
+#define EXPORT_MAX_CLIENTS 256
+#define EXPORT_REQUEST_SIZE 1024
+#define EXPORT_CLIENT_TIMEOUT_MS 5000
+#define EXPORT_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
 
 /*Data Structures */
 
+/**
+ * enum cpu_mode - CPU time buckets, in the order of the cpu_stats line
+ *
+ * Guest time is also counted in user and nice time, so the guest buckets
+ * are left out of totals.
+ */
+enum cpu_mode {
+    CPU_USER,
+    CPU_NICE,
+    CPU_SYSTEM,
+    CPU_IDLE,
+    CPU_IOWAIT,
+    CPU_IRQ,
+    CPU_SOFTIRQ,
+    CPU_STEAL,
+    CPU_GUEST,
+    CPU_GUEST_NICE,
+    NR_CPU_MODES
+};
+
+static const char *const cpu_mode_names[NR_CPU_MODES] = {
+    "user", "nice", "system", "idle", "iowait", "irq", "softirq", "steal", "guest", "guest_nice",
+};
+
+/**
+ * enum task_state - Thread states, in the order of the task_states line
+ */
+enum task_state {
+    TASK_RUNNING,
+    TASK_INTERRUPTIBLE,
+    TASK_UNINTERRUPTIBLE,
+    TASK_STOPPED,
+    TASK_ZOMBIE,
+    TASK_IDLE,
+    NR_TASK_STATES
+};
+
+static const char *const task_state_names[NR_TASK_STATES] = {
+    "running", "interruptible", "uninterruptible", "stopped", "zombie", "idle",
+};
+
+/**
+ * tree_node - One process of the kernel's process_tree section
+ * @pid: Process id
+ * @ppid: Parent process id
+ * @depth: Distance from the root of the process tree
+ * @comm: Command name
+ * @cpu_delta: CPU time used by the process itself in the last walk (ns)
+ * @subtree_cpu: CPU time used by the process, its descendants and reaped children (ns)
+ * @subtree_rss: Resident memory of the process and its descendants (bytes)
+ * @subtree_io: Bytes read and written by the process and its descendants in the last walk
+ * @descendants: Processes in the subtree, including this one
+ */
+struct tree_node {
+    int pid;
+    int ppid;
+    int depth;
+    char comm[COMM_LEN];
+    unsigned long long cpu_delta;
+    unsigned long long subtree_cpu;
+    unsigned long long subtree_rss;
+    unsigned long long subtree_io;
+    unsigned int descendants;
+};
+
+/**
+ * group_row - Totals of one session, process group or user
+ * @id: Session id, process group id or uid
+ * @comm: Command name of the group leader, or the user name
+ * @procs: Processes in the group
+ * @cpu_delta: CPU time used in the last walk (ns)
+ * @rss: Resident memory (bytes)
+ * @io_delta: Bytes read and written in the last walk
+ */
+struct group_row {
+    unsigned long long id;
+    char comm[COMM_LEN];
+    unsigned int procs;
+    unsigned long long cpu_delta;
+    unsigned long long rss;
+    unsigned long long io_delta;
+};
+
+/**
+ * profile_row - One of the functions the profiler sampled most
+ * @samples: Samples whose innermost frame was in the function
+ * @name: Kernel function, or "[user] comm/pid" for a process running in user mode
+ */
+struct profile_row {
+    unsigned long long samples;
+    char name[PROFILE_NAME_LEN];
+};
+
+/**
+ * flight_row - One time slice of a flight recording
+ * @offset_ms: Start of the slice relative to the trigger
+ * @busy: Share of all CPUs busy in the slice (percent)
+ * @max_busy: Busy share of the busiest CPU (percent)
+ * @cpu: Busiest CPU
+ * @nr_running: Runnable tasks, summed over CPUs
+ * @free_kb: Lowest free memory seen in the slice
+ */
+struct flight_row {
+    int offset_ms;
+    int busy;
+    int max_busy;
+    int cpu;
+    unsigned int nr_running;
+    unsigned long long free_kb;
+};
+
+/**
+ * flight_dump - Last recording frozen by the kernel's flight recorder
+ * @seq: Recording number since the module was loaded
+ * @reason: What fired the trigger: manual, cpu, runq or mem
+ * @trigger_ms: Trigger time (ms since boot)
+ * @pre_ms: Recorded time before the trigger
+ * @post_ms: Recorded time after the trigger
+ * @period_ms: Length of one slice
+ * @cpus: Online CPUs when the recording was frozen
+ * @rows: Slices in time order; slices without samples are missing
+ * @nr_rows: Number of valid entries in @rows
+ */
+struct flight_dump {
+    unsigned int seq;
+    char reason[16];
+    unsigned long long trigger_ms;
+    unsigned int pre_ms;
+    unsigned int post_ms;
+    unsigned int period_ms;
+    unsigned int cpus;
+    struct flight_row rows[MAX_FLIGHT_ROWS];
+    int nr_rows;
+};
+
 /**
  * system_stats - Structure to hold parsed system statistics
  *
@@ -27,29 +204,199 @@
  * All values are collected per reading cycle.
  */
 struct system_stats {
-    // CPU statistics
-    unsigned long long user;
-    unsigned long long nice;
-    unsigned long long system;
-    unsigned long long idle;
+    // CPU statistics: cumulative time per mode (ns) and each mode's share of
+    // the interval since the previous sample (percent)
+    unsigned long long cpu[NR_CPU_MODES];
+    double cpu_share[NR_CPU_MODES];
 
     // Memory statistics (in KB)
     unsigned long total_mem;
     unsigned long free_mem;
     unsigned long used_mem;
 
-    // Process information
+    // Process information, and threads by state, from the last complete task walk
     int process_count;
+    unsigned int task_states[NR_TASK_STATES];
+
+    // Scheduler activity since the module was loaded, and the current run queues
+    unsigned long long ctx_switches;
+    unsigned long long irqs;
+    unsigned long long softirqs;
+    unsigned long long forks;
+    unsigned int nr_running;
+    unsigned int nr_iowait;
+
+    // Cost of the last task walk (ns), the maxima since loading, and its RCU sections
+    unsigned long long walk_sweep_ns;
+    unsigned long long walk_max_sweep_ns;
+    unsigned long long walk_section_ns;
+    unsigned long long walk_max_section_ns;
+    unsigned int walk_sections;
+    unsigned long long walk_pause_ns;
+
+    // Statistics file opens and renderings since the module was loaded
+    long long reads_opens;
+    long long reads_cached;
+    long long reads_throttled;
+    long long reads_renders;
+
+    // Idle mode: whether collection is suspended, event subscribers, idle periods so far
+    int idle;
+    int idle_subscribers;
+    unsigned int idle_periods;
 
     // Network statistics
     unsigned long rx_bytes;
     unsigned long tx_bytes;
     unsigned long rx_packets;
     unsigned long tx_packets;
+
+    // I/O statistics, cumulative: bytes and read/write system calls
+    unsigned long read_bytes;
+    unsigned long write_bytes;
+    unsigned long cancelled_write_bytes;
+    unsigned long syscr;
+    unsigned long syscw;
+
+    // Process tree, busiest subtrees first
+    struct tree_node tree[MAX_TREE_NODES];
+    int nr_tree;
+
+    // Sessions and process groups, busiest first
+    struct group_row sessions[MAX_GROUPS];
+    int nr_sessions;
+    struct group_row pgrps[MAX_GROUPS];
+    int nr_pgrps;
+
+    // Users, busiest first
+    struct group_row users[MAX_GROUPS];
+    int nr_users;
+
+    // Profiler samples since it was turned on, and the most sampled functions
+    char profile_state[4];
+    unsigned int profile_hz;
+    unsigned long long profile_kernel;
+    unsigned long long profile_user;
+    unsigned long long profile_idle;
+    unsigned long long profile_dropped;
+    struct profile_row functions[MAX_PROFILE_FUNCS];
+    int nr_functions;
+
+    // Flight recordings frozen since the module was loaded, and the last one
+    unsigned int flight_recordings;
+    struct flight_dump flight;
+};
+
+/**
+ * enum view - Screens the display can show
+ */
+enum view {
+    VIEW_SUMMARY,
+    VIEW_TREE,
+    VIEW_USERS,
+    VIEW_FLIGHT,
+    VIEW_PROFILE,
+};
+
+/**
+ * tree_view - Interactive state of the process tree view
+ * @expand_all: Default state of every node
+ * @toggled: Nodes whose state differs from @expand_all
+ * @nr_toggled: Number of valid entries in @toggled
+ * @selected: Pid of the highlighted node
+ * @cursor: Row of the highlighted node, used when it disappears
+ *
+ * Kept by pid so expansion and selection survive the re-ordering that
+ * every new sample brings.
+ */
+struct tree_view {
+    int expand_all;
+    int toggled[MAX_TREE_NODES];
+    int nr_toggled;
+    int selected;
+    int cursor;
+};
+
+/**
+ * stats_ring - Lock-free single-producer/single-consumer queue of samples
+ * @slots: Parsed samples, indexed by position modulo STATS_RING_SIZE
+ * @head: Next position the collector writes; only the collector stores it
+ * @tail: Next position the renderer reads; only the renderer stores it
+ * @produced: Samples pushed by the collector
+ * @rendered: Samples drawn by the renderer
+ * @dropped: Samples never drawn, either because the ring was full or
+ *           because the renderer skipped ahead to a newer one
+ *
+ * @head and @tail grow without wrapping back; their difference is the
+ * queue depth. Each index is published with release semantics after the
+ * slot it covers has been written or consumed.
+ */
+struct stats_ring {
+    struct system_stats slots[STATS_RING_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_ullong produced;
+    atomic_ullong rendered;
+    atomic_ullong dropped;
+};
+
+/**
+ * export_snapshot - Pre-encoded scrape response shared by all clients
+ * @refs: Holders of this snapshot (the exporter plus clients mid-write)
+ * @len: Length of @data in bytes
+ * @data: Complete HTTP response: status line, headers and OpenMetrics body
+ *
+ * Encoded once per sample. Clients keep a reference while writing so a new
+ * sample never invalidates a response that is still in flight.
+ */
+struct export_snapshot {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+/**
+ * export_client - State of one scrape connection
+ * @fd: Connected socket, -1 when the slot is free
+ * @req: Request bytes received so far
+ * @req_len: Number of valid bytes in @req
+ * @snap: Snapshot being sent, or NULL for a static response
+ * @out: Response being sent
+ * @out_len: Length of @out
+ * @out_off: Bytes of @out already written
+ * @close_after: Close instead of waiting for the next request
+ * @deadline_ms: Monotonic time at which an idle or stalled client is dropped
+ */
+struct export_client {
+    int fd;
+    char req[EXPORT_REQUEST_SIZE];
+    size_t req_len;
+    struct export_snapshot *snap;
+    const char *out;
+    size_t out_len;
+    size_t out_off;
+    int close_after;
+    long long deadline_ms;
+};
+
+/**
+ * strbuf - Growable text buffer used by the encoder
+ */
+struct strbuf {
+    char *buf;
+    size_t len;
+    size_t cap;
 };
 
 /* Global Variables */
-static volatile int running = 1;
+static atomic_int running = 1;
+static struct stats_ring stats_ring;
+static int collector_wake_fd = -1;
+static atomic_int collector_error;
+static struct export_client export_clients[EXPORT_MAX_CLIENTS];
+static struct export_snapshot *export_current;
+static struct tree_view tree_view;
+static enum view current_view = VIEW_SUMMARY;
 
 /* Function Declarations */
 
@@ -77,13 +424,148 @@ void parse_line(char *line, struct system_stats *stats) {
     if (!key || !value) return;
 
     if (strcmp(key, "cpu_stats") == 0) {
-        sscanf(value, "%llu,%llu,%llu,%llu", &stats->user, &stats->nice, &stats->system, &stats->idle);
+        for (int i = 0; i < NR_CPU_MODES && *value; i++) {
+            stats->cpu[i] = strtoull(value, &value, 10);
+            if (*value == ',') value++;
+        }
     } else if (strcmp(key, "memory_stats") == 0 ) {
         sscanf(value, "%lu,%lu,%lu", &stats->total_mem, &stats->free_mem, &stats->used_mem);
     } else if (strcmp(key, "process_count") == 0) {
         sscanf(value, "%d", &stats->process_count);
+    } else if (strcmp(key, "task_states") == 0) {
+        for (int i = 0; i < NR_TASK_STATES && *value; i++) {
+            stats->task_states[i] = strtoul(value, &value, 10);
+            if (*value == ',') value++;
+        }
+    } else if (strcmp(key, "sched_stats") == 0) {
+        sscanf(value, "%llu,%llu,%llu,%llu,%u,%u", &stats->ctx_switches, &stats->irqs, &stats->softirqs,
+               &stats->forks, &stats->nr_running, &stats->nr_iowait);
+    } else if (strcmp(key, "task_walk") == 0) {
+        sscanf(value, "%llu,%llu,%llu,%llu,%u,%llu", &stats->walk_sweep_ns, &stats->walk_max_sweep_ns,
+               &stats->walk_section_ns, &stats->walk_max_section_ns, &stats->walk_sections, &stats->walk_pause_ns);
+    } else if (strcmp(key, "stats_reads") == 0) {
+        sscanf(value, "%lld,%lld,%lld,%lld", &stats->reads_opens, &stats->reads_cached, &stats->reads_throttled,
+               &stats->reads_renders);
+    } else if (strcmp(key, "idle") == 0) {
+        sscanf(value, "%*[^,],%*u,%d,%d,%u", &stats->idle, &stats->idle_subscribers, &stats->idle_periods);
     } else if (strcmp(key, "network_stats") == 0) {
         sscanf(value, "%lu,%lu,%lu,%lu", &stats->rx_bytes, &stats->tx_bytes, &stats->rx_packets, &stats->tx_packets);
+    } else if (strcmp(key, "io_stats") == 0) {
+        sscanf(value, "%lu,%lu,%lu,%lu,%lu", &stats->read_bytes, &stats->write_bytes,
+               &stats->cancelled_write_bytes, &stats->syscr, &stats->syscw);
+    } else if (strcmp(key, "flight") == 0) {
+        sscanf(value, "%*[^,],%*u,%*u,%*u,%*u,%*u,%u", &stats->flight_recordings);
+    } else if (strcmp(key, "profile") == 0) {
+        sscanf(value, "%3[^,],%u,%llu,%llu,%llu,%llu", stats->profile_state, &stats->profile_hz,
+               &stats->profile_kernel, &stats->profile_user, &stats->profile_idle, &stats->profile_dropped);
+    }
+}
+
+/**
+ * parse_group_row - Parses one row of the sessions or process_groups section
+ * @line: Row of the form id,comm,procs,cpu_delta,rss,io_delta
+ * @rows: Table to append to
+ * @count: Number of rows in @rows, updated on success
+ */
+void parse_group_row(const char *line, struct group_row *rows, int *count) {
+    struct group_row *row = &rows[*count];
+
+    if (*count >= MAX_GROUPS) return;
+    if (sscanf(line, "%llu,%15[^,],%u,%llu,%llu,%llu", &row->id, row->comm, &row->procs,
+               &row->cpu_delta, &row->rss, &row->io_delta) == 6) {
+        (*count)++;
+    }
+}
+
+/**
+ * user_name - One cached uid to user name lookup
+ * @uid: User id
+ * @valid: Entry holds a lookup result
+ * @name: User name, empty if the uid has none
+ */
+struct user_name {
+    unsigned long long uid;
+    int valid;
+    char name[COMM_LEN];
+};
+
+// Direct-mapped on the uid; only the collector thread touches it
+static struct user_name user_names[USER_NAME_CACHE];
+
+/**
+ * lookup_user_name - Resolves a uid to a user name through a small cache
+ * @uid: User id
+ * @name: Buffer of COMM_LEN bytes for the name
+ *
+ * The busiest users rarely change between samples, so the name service is
+ * asked at most once per uid until another uid takes its slot. Unknown
+ * uids are cached too, with an empty name.
+ */
+static void lookup_user_name(unsigned long long uid, char *name) {
+    struct user_name *e = &user_names[uid % USER_NAME_CACHE];
+    struct passwd pw, *result;
+    char buf[1024];
+
+    if (!e->valid || e->uid != uid) {
+        e->uid = uid;
+        e->valid = 1;
+        e->name[0] = '\0';
+        if (getpwuid_r(uid, &pw, buf, sizeof(buf), &result) == 0 && result) {
+            snprintf(e->name, sizeof(e->name), "%s", pw.pw_name);
+        }
+    }
+    snprintf(name, COMM_LEN, "%s", e->name);
+}
+
+/**
+ * parse_user_row - Parses one row of the users section
+ * @line: Row of the form uid,procs,cpu_delta,rss,io_delta
+ * @stats: Statistics structure to update
+ *
+ * The user name is looked up here, in the collector thread, so a slow
+ * name service never stalls drawing. Unknown uids keep an empty name.
+ */
+void parse_user_row(const char *line, struct system_stats *stats) {
+    struct group_row *row = &stats->users[stats->nr_users];
+
+    if (stats->nr_users >= MAX_GROUPS) return;
+    if (sscanf(line, "%llu,%u,%llu,%llu,%llu", &row->id, &row->procs, &row->cpu_delta, &row->rss,
+               &row->io_delta) != 5) {
+        return;
+    }
+    lookup_user_name(row->id, row->comm);
+    stats->nr_users++;
+}
+
+/**
+ * parse_row - Parses one row of a multi-line section
+ * @section: Name of the section the row belongs to
+ * @line: Comma-separated row
+ * @stats: Statistics structure to update
+ *
+ * Rows of sections the display does not use are ignored.
+ */
+void parse_row(const char *section, const char *line, struct system_stats *stats) {
+    if (strcmp(section, "process_tree") == 0 && stats->nr_tree < MAX_TREE_NODES) {
+        struct tree_node *node = &stats->tree[stats->nr_tree];
+
+        if (sscanf(line, "%d,%d,%d,%15[^,],%llu,%llu,%llu,%llu,%u", &node->pid, &node->ppid, &node->depth,
+                   node->comm, &node->cpu_delta, &node->subtree_cpu, &node->subtree_rss,
+                   &node->subtree_io, &node->descendants) == 9) {
+            stats->nr_tree++;
+        }
+    } else if (strcmp(section, "sessions") == 0) {
+        parse_group_row(line, stats->sessions, &stats->nr_sessions);
+    } else if (strcmp(section, "process_groups") == 0) {
+        parse_group_row(line, stats->pgrps, &stats->nr_pgrps);
+    } else if (strcmp(section, "users") == 0) {
+        parse_user_row(line, stats);
+    } else if (strcmp(section, "profile_functions") == 0 && stats->nr_functions < MAX_PROFILE_FUNCS) {
+        struct profile_row *row = &stats->functions[stats->nr_functions];
+
+        if (sscanf(line, "%llu,%63[^\n]", &row->samples, row->name) == 2) {
+            stats->nr_functions++;
+        }
     }
 }
 
@@ -91,22 +573,107 @@ void parse_line(char *line, struct system_stats *stats) {
  * read_stats - Reads and parses all statistics from proc file
  * @stats: Statistics structure to fill
  *
- * Opens proc file, reads all lines, and parses each line.
- * Exits program if proc file cannot be opened.
+ * Opens proc file, reads all lines, and parses each line. A "name:" line
+ * starts a section whose rows all begin with a number; the section ends at
+ * a blank line or at the next key:value line.
+ * Returns 0 on success or -1 if the proc file cannot be opened.
  */
-void read_stats(struct system_stats *stats) {
+int read_stats(struct system_stats *stats) {
     FILE *fp = fopen(PROC_FILE, "r");
     if (!fp) {
-        perror("Failed to open proc file");
-        exit(1);
+        return -1;
     }
-    
+
+    memset(stats, 0, sizeof(*stats));
     char line[256];
+    char section[32] = "";
     while (fgets(line, sizeof(line), fp)) {
+        size_t len = strcspn(line, "\n");
+
+        // Longer rows, such as folded profiler stacks, are cut at the buffer size
+        if (line[len] != '\n') {
+            int c;
+
+            while ((c = fgetc(fp)) != EOF && c != '\n');
+        }
+        if (section[0] && (line[0] == '-' || (line[0] >= '0' && line[0] <= '9'))) {
+            parse_row(section, line, stats);
+            continue;
+        }
+        section[0] = '\0';
+        if (len > 1 && len < sizeof(section) && line[len - 1] == ':') {
+            memcpy(section, line, len - 1);
+            section[len - 1] = '\0';
+            continue;
+        }
         parse_line(line, stats);
     }
 
     fclose(fp);
+    return 0;
+}
+
+/**
+ * cpu_update_shares - Computes each CPU mode's share of the last interval
+ * @stats: New sample; its cpu_share array is filled in
+ * @prev_cpu: CPU times of the previous sample, or all zeroes for shares since boot
+ */
+void cpu_update_shares(struct system_stats *stats, const unsigned long long *prev_cpu) {
+    unsigned long long delta[NR_CPU_MODES], total = 0;
+
+    for (int i = 0; i < NR_CPU_MODES; i++) {
+        delta[i] = stats->cpu[i] >= prev_cpu[i] ? stats->cpu[i] - prev_cpu[i] : 0;
+        if (i < CPU_GUEST) total += delta[i];
+    }
+    for (int i = 0; i < NR_CPU_MODES; i++) {
+        stats->cpu_share[i] = total ? 100.0 * delta[i] / total : 0;
+    }
+    // No CPU time passed (module reloaded or counters not yet updated): show idle
+    if (!total) stats->cpu_share[CPU_IDLE] = 100;
+}
+
+/**
+ * display_cpu_bar - Draws the CPU usage bar broken down by mode
+ * @y: Screen row
+ * @stats: Sample to draw
+ *
+ * Each busy mode gets its own letter and color; idle time is left blank.
+ * A legend with the exact percentages follows the bar.
+ */
+void display_cpu_bar(int y, const struct system_stats *stats) {
+    static const struct {
+        int mode;
+        char glyph;
+        int color;
+    } parts[] = {
+        { CPU_USER, 'u', 1 }, { CPU_NICE, 'n', 5 }, { CPU_SYSTEM, 's', 6 }, { CPU_IOWAIT, 'w', 3 },
+        { CPU_IRQ, 'i', 4 }, { CPU_SOFTIRQ, 'q', 2 }, { CPU_STEAL, 't', 7 },
+    };
+    double filled = 0;
+    int x = 3, drawn = 0;
+
+    mvaddch(y, 2, '[');
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        int cells;
+
+        // Round the running total so the bar length matches the busy share
+        filled += stats->cpu_share[parts[i].mode];
+        cells = (int)(filled * CPU_BAR_WIDTH / 100 + 0.5) - drawn;
+        attron(COLOR_PAIR(parts[i].color));
+        for (int c = 0; c < cells && drawn < CPU_BAR_WIDTH; c++, drawn++) {
+            mvaddch(y, x++, parts[i].glyph);
+        }
+        attroff(COLOR_PAIR(parts[i].color));
+    }
+    mvaddch(y, 3 + CPU_BAR_WIDTH, ']');
+
+    x = 5 + CPU_BAR_WIDTH;
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        attron(COLOR_PAIR(parts[i].color));
+        mvprintw(y, x, "%c:%.1f", parts[i].glyph, stats->cpu_share[parts[i].mode]);
+        attroff(COLOR_PAIR(parts[i].color));
+        x += 9;
+    }
 }
 
 /**
@@ -114,16 +681,20 @@ void read_stats(struct system_stats *stats) {
  * @stats: Statistics to display
  *
  * Formats and displays all statistics in a colored, organized layout.
- * Uses different colors for different types of statistics.
+ * Uses different colors for different types of statistics. The last line
+ * shows the collector/renderer pipeline counters.
  */
 void display_stats(struct system_stats *stats) {
+    unsigned int head = atomic_load(&stats_ring.head);
+    unsigned int tail = atomic_load(&stats_ring.tail);
+
     clear();
 
-    float cpu_total = stats->user + stats->nice + stats->system + stats->idle;
-    float cpu_used = (cpu_total - stats->idle) / cpu_total * 100;
+    float cpu_used = 100 - stats->cpu_share[CPU_IDLE] - stats->cpu_share[CPU_IOWAIT];
 
     attron(COLOR_PAIR(1));
     mvprintw(1, 2, "CPU Usage: %-6.2f%%", cpu_used);
+    display_cpu_bar(2, stats);
 
     float mem_used_gb = stats->used_mem / (1024.0 * 1024);
     float mem_total_gb = stats->total_mem / (1024.0 * 1024);
@@ -139,37 +710,1134 @@ void display_stats(struct system_stats *stats) {
     mvprintw(8, 4, "RX: %-6.2f MB (%-6.2f MB/s)", stats->rx_bytes / (1024.0 * 1024), stats->rx_packets / (1024.0 * 1024));
     mvprintw(9, 4, "TX: %-6.2f MB (%-6.2f MB/s)", stats->tx_bytes / (1024.0 * 1024), stats->tx_packets / (1024.0 * 1024));
 
+    attroff(COLOR_PAIR(4));
+    mvprintw(11, 2, "Frames: %llu collected, %llu rendered, %llu dropped, queue depth %u",
+             atomic_load(&stats_ring.produced), atomic_load(&stats_ring.rendered),
+             atomic_load(&stats_ring.dropped), head - tail);
+    mvprintw(13, 2, "t: process tree  u: users  p: profile  f: flight recording  r: redraw  q: quit");
+
     refresh();
 }
 
 /**
- * main - Program entry point
+ * tree_find - Returns the index of @pid in the sample's tree, or -1
+ * @stats: Sample holding the tree
+ * @pid: Process id to look up
+ */
+int tree_find(const struct system_stats *stats, int pid) {
+    for (int i = 0; i < stats->nr_tree; i++) {
+        if (stats->tree[i].pid == pid) return i;
+    }
+    return -1;
+}
+
+/**
+ * tree_expanded - Tells whether the children of @pid are shown
+ * @pid: Process id of the node
+ */
+int tree_expanded(int pid) {
+    for (int i = 0; i < tree_view.nr_toggled; i++) {
+        if (tree_view.toggled[i] == pid) return !tree_view.expand_all;
+    }
+    return tree_view.expand_all;
+}
+
+/**
+ * tree_toggle - Expands a collapsed node or collapses an expanded one
+ * @pid: Process id of the node
+ */
+void tree_toggle(int pid) {
+    for (int i = 0; i < tree_view.nr_toggled; i++) {
+        if (tree_view.toggled[i] == pid) {
+            tree_view.toggled[i] = tree_view.toggled[--tree_view.nr_toggled];
+            return;
+        }
+    }
+    if (tree_view.nr_toggled < MAX_TREE_NODES) {
+        tree_view.toggled[tree_view.nr_toggled++] = pid;
+    }
+}
+
+/**
+ * tree_walk - Appends @index and its visible descendants to @rows
+ * @stats: Sample holding the tree
+ * @index: Node to append
+ * @level: Indentation level of the node
+ * @rows: Visible rows as tree indices, in display order
+ * @levels: Indentation level of each row
+ * @count: Number of rows so far, updated
  *
- * Initializes ncurses, sets up signal handling, and runs main display loop.
- * Updates display every 500ms until interrupted.
+ * Children are visited in the kernel's order, busiest subtree first.
  */
-int main() {
-    signal(SIGINT, signal_handler);
+void tree_walk(const struct system_stats *stats, int index, int level, int *rows, int *levels, int *count) {
+    if (*count >= MAX_TREE_NODES) return;
+
+    rows[*count] = index;
+    levels[*count] = level;
+    (*count)++;
+
+    if (!tree_expanded(stats->tree[index].pid)) return;
+    for (int i = 0; i < stats->nr_tree; i++) {
+        if (i != index && stats->tree[i].ppid == stats->tree[index].pid) {
+            tree_walk(stats, i, level + 1, rows, levels, count);
+        }
+    }
+}
+
+/**
+ * tree_rows - Lists the rows the tree view shows
+ * @stats: Sample holding the tree
+ * @rows: Filled with tree indices in display order
+ * @levels: Filled with the indentation level of each row
+ *
+ * Nodes whose parent is not in the sample are shown as roots.
+ * Returns the number of rows.
+ */
+int tree_rows(const struct system_stats *stats, int *rows, int *levels) {
+    int count = 0;
+
+    for (int i = 0; i < stats->nr_tree; i++) {
+        const struct tree_node *node = &stats->tree[i];
+
+        if (node->ppid == node->pid || tree_find(stats, node->ppid) < 0) {
+            tree_walk(stats, i, 0, rows, levels, &count);
+        }
+    }
+    return count;
+}
+
+/**
+ * tree_select - Resolves the highlighted row of the current sample
+ * @stats: Sample being shown
+ * @rows: Visible rows from tree_rows()
+ * @count: Number of visible rows
+ *
+ * Follows the selected pid; if it is gone the cursor stays on the same row.
+ * Returns the highlighted row, or -1 if there are no rows.
+ */
+int tree_select(const struct system_stats *stats, const int *rows, int count) {
+    if (count == 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (stats->tree[rows[i]].pid == tree_view.selected) {
+            tree_view.cursor = i;
+            return i;
+        }
+    }
+    if (tree_view.cursor >= count) tree_view.cursor = count - 1;
+    if (tree_view.cursor < 0) tree_view.cursor = 0;
+    tree_view.selected = stats->tree[rows[tree_view.cursor]].pid;
+    return tree_view.cursor;
+}
+
+/**
+ * display_groups - Draws the busiest rows of a session or process group table
+ * @y: First screen row
+ * @title: Table heading
+ * @groups: Rows to draw
+ * @count: Number of rows in @groups
+ *
+ * Returns the screen row after the table.
+ */
+int display_groups(int y, const char *title, const struct group_row *groups, int count) {
+    mvprintw(y++, 2, "%-16s %8s %-16s %6s %10s %10s %10s", title, "ID", "LEADER", "PROCS", "CPU ms", "RSS MB", "IO KB");
+    for (int i = 0; i < count && i < GROUP_ROWS && y < LINES; i++) {
+        const struct group_row *g = &groups[i];
+
+        mvprintw(y++, 2, "%-16s %8llu %-16s %6u %10.1f %10.1f %10.1f", "", g->id, g->comm, g->procs,
+                 g->cpu_delta / 1e6, g->rss / (1024.0 * 1024), g->io_delta / 1024.0);
+    }
+    return y + 1;
+}
+
+/**
+ * display_tree - Draws the process tree view
+ * @stats: Sample to draw
+ *
+ * One row per process: expansion marker, command, own CPU time and the
+ * totals of its subtree. Session and process group totals follow when the
+ * terminal is tall enough.
+ */
+void display_tree(const struct system_stats *stats) {
+    int rows[MAX_TREE_NODES], levels[MAX_TREE_NODES];
+    int count = tree_rows(stats, rows, levels);
+    int selected = tree_select(stats, rows, count);
+    int tree_lines = LINES - 2 * (GROUP_ROWS + 2) - 3;
+    int first = 0, y = 1;
+
+    clear();
+
+    if (tree_lines < 5) tree_lines = LINES - 3;
+    if (selected >= tree_lines) first = selected - tree_lines + 1;
+
+    attron(COLOR_PAIR(3));
+    mvprintw(y++, 2, "%-36s %7s %10s %10s %10s %10s %6s", "PROCESS", "PID", "CPU ms", "TREE ms", "RSS MB", "IO KB", "PROCS");
+    attroff(COLOR_PAIR(3));
+
+    for (int i = first; i < count && i < first + tree_lines; i++) {
+        const struct tree_node *node = &stats->tree[rows[i]];
+        const char *marker = node->descendants <= 1 ? "   " : tree_expanded(node->pid) ? "[-]" : "[+]";
+        char label[64];
+
+        snprintf(label, sizeof(label), "%*s%s %s", levels[i] * 2, "", marker, node->comm);
+        if (i == selected) attron(A_REVERSE);
+        mvprintw(y++, 2, "%-36.36s %7d %10.1f %10.1f %10.1f %10.1f %6u", label, node->pid,
+                 node->cpu_delta / 1e6, node->subtree_cpu / 1e6, node->subtree_rss / (1024.0 * 1024),
+                 node->subtree_io / 1024.0, node->descendants);
+        if (i == selected) attroff(A_REVERSE);
+    }
+
+    y++;
+    attron(COLOR_PAIR(1));
+    y = display_groups(y, "Sessions", stats->sessions, stats->nr_sessions);
+    attron(COLOR_PAIR(4));
+    display_groups(y, "Process groups", stats->pgrps, stats->nr_pgrps);
+    attroff(COLOR_PAIR(4));
+
+    mvprintw(LINES - 1, 2, "up/down: select  enter: expand/collapse  +/-: all  m: summary  u: users  q: quit");
+    refresh();
+}
+
+/**
+ * display_users - Draws the users view
+ * @stats: Sample to draw
+ *
+ * One row per user, busiest first, with each user's share of the CPU time
+ * all listed users consumed in the last walk.
+ */
+void display_users(const struct system_stats *stats) {
+    unsigned long long total = 0;
+    int y = 1;
+
+    clear();
+
+    for (int i = 0; i < stats->nr_users; i++) {
+        total += stats->users[i].cpu_delta;
+    }
+
+    attron(COLOR_PAIR(3));
+    mvprintw(y++, 2, "%-16s %10s %6s %10s %6s %10s %10s", "USER", "UID", "PROCS", "CPU ms", "CPU %", "RSS MB", "IO KB");
+    attroff(COLOR_PAIR(3));
+
+    for (int i = 0; i < stats->nr_users && y < LINES - 2; i++) {
+        const struct group_row *u = &stats->users[i];
+        char name[COMM_LEN];
+
+        snprintf(name, sizeof(name), "%s", u->comm[0] ? u->comm : "?");
+        mvprintw(y++, 2, "%-16s %10llu %6u %10.1f %6.1f %10.1f %10.1f", name, u->id, u->procs, u->cpu_delta / 1e6,
+                 total ? u->cpu_delta * 100.0 / total : 0.0, u->rss / (1024.0 * 1024), u->io_delta / 1024.0);
+    }
+
+    mvprintw(LINES - 1, 2, "m: summary  t: process tree  q: quit");
+    refresh();
+}
+
+/**
+ * read_flight - Reads the last flight recording
+ * @dump: Filled in from PROC_FLIGHT
+ *
+ * Returns 0 on success or -1 if there is no recording yet or the file
+ * cannot be opened.
+ */
+int read_flight(struct flight_dump *dump) {
+    FILE *fp = fopen(PROC_FLIGHT, "r");
+    char line[256];
+
+    if (!fp) {
+        return -1;
+    }
+
+    memset(dump, 0, sizeof(*dump));
+    while (fgets(line, sizeof(line), fp)) {
+        struct flight_row *row = &dump->rows[dump->nr_rows];
+
+        if (sscanf(line, "flight_dump:%u,%15[^,],%llu,%u,%u,%u,%u", &dump->seq, dump->reason, &dump->trigger_ms,
+                   &dump->pre_ms, &dump->post_ms, &dump->period_ms, &dump->cpus) == 7) {
+            continue;
+        }
+        if (dump->nr_rows < MAX_FLIGHT_ROWS &&
+            sscanf(line, "%d,%d,%d,%d,%u,%llu", &row->offset_ms, &row->busy, &row->max_busy, &row->cpu,
+                   &row->nr_running, &row->free_kb) == 6) {
+            dump->nr_rows++;
+        }
+    }
+
+    fclose(fp);
+    return dump->seq ? 0 : -1;
+}
+
+/**
+ * display_flight - Displays the last flight recording
+ * @stats: Sample carrying the recording read by the collector thread
+ *
+ * Charts the share of all CPUs that was busy across the recorded window,
+ * one column per group of slices, with the busiest single CPU drawn as '.'
+ * above it and the trigger marked under the chart. A new recording shows
+ * up with the next sample without leaving the view.
+ */
+void display_flight(struct system_stats *stats) {
+    const struct flight_dump *dump = &stats->flight;
+    int width = COLS - 10, busy[COLS], max_busy[COLS];
+    const struct flight_row *peak = NULL, *low_mem = NULL;
+    unsigned int max_running = 0;
+    int span, y = 1;
+
+    clear();
+
+    if (width < 10 || !dump->nr_rows) {
+        mvprintw(y, 2, "No flight recording yet. Arm the recorder with:");
+        mvprintw(y + 1, 4, "echo 'flight on' > /proc/system_monitor_control");
+        mvprintw(LINES - 1, 2, "m: summary  t: process tree  u: users  q: quit");
+        refresh();
+        return;
+    }
+
+    attron(COLOR_PAIR(3));
+    mvprintw(y++, 2, "Flight recording %u: %s trigger at %.3f s, -%u/+%u ms in %u ms slices, %u CPUs",
+             dump->seq, dump->reason, dump->trigger_ms / 1000.0, dump->pre_ms,
+             dump->post_ms, dump->period_ms, dump->cpus);
+    attroff(COLOR_PAIR(3));
+    y++;
+
+    span = dump->pre_ms + dump->post_ms;
+    memset(busy, 0, sizeof(busy));
+    memset(max_busy, 0, sizeof(max_busy));
+    for (int i = 0; i < dump->nr_rows; i++) {
+        const struct flight_row *row = &dump->rows[i];
+        int col = (long long)(row->offset_ms + (int)dump->pre_ms) * width / span;
+
+        if (col < 0 || col >= width) continue;
+        if (row->busy > busy[col]) busy[col] = row->busy;
+        if (row->max_busy > max_busy[col]) max_busy[col] = row->max_busy;
+        if (!peak || row->busy > peak->busy) peak = row;
+        if (!low_mem || row->free_kb < low_mem->free_kb) low_mem = row;
+        if (row->nr_running > max_running) max_running = row->nr_running;
+    }
+
+    // Each chart row covers 100 / FLIGHT_CHART_ROWS percent, filled from the bottom
+    for (int level = FLIGHT_CHART_ROWS; level > 0; level--, y++) {
+        int threshold = (level * 100 - 50) / FLIGHT_CHART_ROWS;
+
+        if (level == FLIGHT_CHART_ROWS || level == FLIGHT_CHART_ROWS / 2 || level == 1) {
+            mvprintw(y, 2, "%3d%%", level * 100 / FLIGHT_CHART_ROWS);
+        }
+        mvaddch(y, 7, '|');
+        for (int col = 0; col < width; col++) {
+            if (busy[col] >= threshold) {
+                attron(COLOR_PAIR(1));
+                mvaddch(y, 8 + col, '#');
+                attroff(COLOR_PAIR(1));
+            } else if (max_busy[col] >= threshold) {
+                mvaddch(y, 8 + col, '.');
+            }
+        }
+    }
+    mvprintw(y, 7, "+");
+    for (int col = 0; col < width; col++) {
+        mvaddch(y, 8 + col, '-');
+    }
+    y++;
+    attron(COLOR_PAIR(6));
+    mvaddch(y, 8 + (long long)dump->pre_ms * width / span, '^');
+    attroff(COLOR_PAIR(6));
+    mvprintw(y, 2, "%+dms", -(int)dump->pre_ms);
+    mvprintw(y, COLS - 10, "%+dms", (int)dump->post_ms);
+    y += 2;
+
+    mvprintw(y++, 2, "Peak: %d%% of all CPUs at %+d ms, busiest CPU %d at %d%%", peak->busy, peak->offset_ms,
+             peak->cpu, peak->max_busy);
+    mvprintw(y++, 2, "Run queue peak: %u tasks   Free memory low: %.1f MB at %+d ms", max_running,
+             low_mem->free_kb / 1024.0, low_mem->offset_ms);
+
+    mvprintw(LINES - 1, 2, "m: summary  t: process tree  u: users  q: quit");
+    refresh();
+}
+
+/**
+ * display_profile - Displays the functions the kernel profiler sampled most
+ * @stats: Sample to draw
+ *
+ * Shares are of the samples that found a CPU busy. Kernel samples count
+ * against the innermost kernel function; samples taken in user mode count
+ * against the process.
+ */
+void display_profile(const struct system_stats *stats) {
+    unsigned long long busy = stats->profile_kernel + stats->profile_user;
+    unsigned long long total = busy + stats->profile_idle;
+    int width = COLS - 40, y = 1;
+
+    clear();
+
+    if (!total) {
+        mvprintw(y, 2, "No profile samples yet. Start the profiler with:");
+        mvprintw(y + 1, 4, "echo 'profile on' > /proc/system_monitor_control");
+        mvprintw(LINES - 1, 2, "m: summary  t: process tree  u: users  q: quit");
+        refresh();
+        return;
+    }
+
+    attron(COLOR_PAIR(3));
+    mvprintw(y++, 2, "Profiler %s at %u Hz: %llu samples, kernel %.1f%%, user %.1f%%, idle %.1f%%, %llu dropped",
+             stats->profile_state, stats->profile_hz, total, stats->profile_kernel * 100.0 / total,
+             stats->profile_user * 100.0 / total, stats->profile_idle * 100.0 / total, stats->profile_dropped);
+    y++;
+    mvprintw(y++, 2, "%10s %6s  %s", "SAMPLES", "BUSY %", "FUNCTION");
+    attroff(COLOR_PAIR(3));
+
+    for (int i = 0; i < stats->nr_functions && y < LINES - 2; i++, y++) {
+        const struct profile_row *f = &stats->functions[i];
+        double share = busy ? f->samples * 100.0 / busy : 0;
+        int cells = width > 0 ? (int)(share * width / 100 + 0.5) : 0;
+
+        mvprintw(y, 2, "%10llu %6.1f  %-26.26s ", f->samples, share, f->name);
+        attron(COLOR_PAIR(f->name[0] == '[' ? 5 : 6));
+        for (int c = 0; c < cells; c++) {
+            addch('#');
+        }
+        attroff(COLOR_PAIR(f->name[0] == '[' ? 5 : 6));
+    }
+
+    mvprintw(LINES - 1, 2, "m: summary  t: process tree  u: users  q: quit");
+    refresh();
+}
+
+/**
+ * tree_key - Handles a key pressed in the tree view
+ * @stats: Sample currently shown
+ * @ch: Key code
+ */
+void tree_key(const struct system_stats *stats, int ch) {
+    int rows[MAX_TREE_NODES], levels[MAX_TREE_NODES];
+    int count = tree_rows(stats, rows, levels);
+    int selected = tree_select(stats, rows, count);
+
+    if (selected < 0) return;
+
+    if (ch == KEY_UP && selected > 0) {
+        selected--;
+    } else if (ch == KEY_DOWN && selected < count - 1) {
+        selected++;
+    } else if (ch == '\n' || ch == KEY_ENTER || ch == ' ') {
+        tree_toggle(stats->tree[rows[selected]].pid);
+    } else if (ch == '+' || ch == '-') {
+        tree_view.expand_all = ch == '+';
+        tree_view.nr_toggled = 0;
+    }
+    tree_view.cursor = selected;
+    tree_view.selected = stats->tree[rows[selected]].pid;
+}
+
+/**
+ * render - Draws the active view
+ * @stats: Sample to draw
+ */
+void render(struct system_stats *stats) {
+    switch (current_view) {
+    case VIEW_TREE:
+        display_tree(stats);
+        break;
+    case VIEW_USERS:
+        display_users(stats);
+        break;
+    case VIEW_FLIGHT:
+        display_flight(stats);
+        break;
+    case VIEW_PROFILE:
+        display_profile(stats);
+        break;
+    default:
+        display_stats(stats);
+        break;
+    }
+}
+
+/**
+ * now_ms - Returns monotonic time in milliseconds
+ */
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * sb_printf - Appends formatted text to a strbuf
+ * @sb: Buffer to append to, grown as needed
+ * @fmt: printf-style format
+ *
+ * Returns 0 on success or -1 if the buffer could not be grown.
+ */
+int sb_printf(struct strbuf *sb, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        size_t avail = sb->cap - sb->len;
+
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->buf ? sb->buf + sb->len : NULL, avail, fmt, ap);
+        va_end(ap);
+        if (n < 0) return -1;
+        if ((size_t)n < avail) {
+            sb->len += n;
+            return 0;
+        }
+
+        size_t cap = sb->cap ? sb->cap * 2 : BUFFER_SIZE;
+        while (cap <= sb->len + n) cap *= 2;
+        char *buf = realloc(sb->buf, cap);
+        if (!buf) return -1;
+        sb->buf = buf;
+        sb->cap = cap;
+    }
+}
+
+/**
+ * om_family - Writes the OpenMetrics metadata lines for a metric family
+ * @sb: Output buffer
+ * @name: Metric family name
+ * @type: OpenMetrics type ("gauge" or "counter")
+ * @help: Help text
+ */
+void om_family(struct strbuf *sb, const char *name, const char *type, const char *help) {
+    sb_printf(sb, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/**
+ * encode_openmetrics - Encodes one sample as an OpenMetrics text body
+ * @sb: Output buffer, reset before encoding
+ * @stats: Parsed statistics, or NULL if the module could not be read
+ */
+void encode_openmetrics(struct strbuf *sb, const struct system_stats *stats) {
+    sb->len = 0;
+
+    om_family(sb, "system_monitor_up", "gauge", "Whether the kernel module statistics could be read.");
+    sb_printf(sb, "system_monitor_up %d\n", stats != NULL);
+    if (!stats) goto out;
+
+    om_family(sb, "system_monitor_cpu_seconds", "counter", "CPU time spent in each mode.");
+    for (int i = 0; i < NR_CPU_MODES; i++) {
+        sb_printf(sb, "system_monitor_cpu_seconds_total{mode=\"%s\"} %.3f\n", cpu_mode_names[i], stats->cpu[i] / 1e9);
+    }
+
+    om_family(sb, "system_monitor_memory_total_bytes", "gauge", "Total usable RAM.");
+    sb_printf(sb, "system_monitor_memory_total_bytes %llu\n", stats->total_mem * 1024ULL);
+    om_family(sb, "system_monitor_memory_free_bytes", "gauge", "Free RAM.");
+    sb_printf(sb, "system_monitor_memory_free_bytes %llu\n", stats->free_mem * 1024ULL);
+    om_family(sb, "system_monitor_memory_used_bytes", "gauge", "Used RAM.");
+    sb_printf(sb, "system_monitor_memory_used_bytes %llu\n", stats->used_mem * 1024ULL);
+
+    om_family(sb, "system_monitor_processes", "gauge", "Number of processes.");
+    sb_printf(sb, "system_monitor_processes %d\n", stats->process_count);
+    om_family(sb, "system_monitor_threads", "gauge", "Threads by state at the last complete task walk.");
+    for (int i = 0; i < NR_TASK_STATES; i++) {
+        sb_printf(sb, "system_monitor_threads{state=\"%s\"} %u\n", task_state_names[i], stats->task_states[i]);
+    }
+
+    om_family(sb, "system_monitor_context_switches", "counter", "Context switches on all CPUs.");
+    sb_printf(sb, "system_monitor_context_switches_total %llu\n", stats->ctx_switches);
+    om_family(sb, "system_monitor_interrupts", "counter", "Hardware interrupts on all CPUs.");
+    sb_printf(sb, "system_monitor_interrupts_total %llu\n", stats->irqs);
+    om_family(sb, "system_monitor_softirqs", "counter", "Softirqs run on all CPUs.");
+    sb_printf(sb, "system_monitor_softirqs_total %llu\n", stats->softirqs);
+    om_family(sb, "system_monitor_forks", "counter", "Processes and threads created.");
+    sb_printf(sb, "system_monitor_forks_total %llu\n", stats->forks);
+    om_family(sb, "system_monitor_runnable_tasks", "gauge", "Tasks on the run queues of all CPUs.");
+    sb_printf(sb, "system_monitor_runnable_tasks %u\n", stats->nr_running);
+    om_family(sb, "system_monitor_iowait_tasks", "gauge", "Tasks sleeping uninterruptibly on I/O.");
+    sb_printf(sb, "system_monitor_iowait_tasks %u\n", stats->nr_iowait);
+
+    om_family(sb, "system_monitor_task_walk_seconds", "gauge", "Duration of the last task walk, pauses included.");
+    sb_printf(sb, "system_monitor_task_walk_seconds %.6f\n", stats->walk_sweep_ns / 1e9);
+    om_family(sb, "system_monitor_task_walk_max_seconds", "gauge", "Longest task walk since the module was loaded.");
+    sb_printf(sb, "system_monitor_task_walk_max_seconds %.6f\n", stats->walk_max_sweep_ns / 1e9);
+    om_family(sb, "system_monitor_task_walk_rcu_section_seconds", "gauge",
+              "Longest RCU read-side section of the last task walk.");
+    sb_printf(sb, "system_monitor_task_walk_rcu_section_seconds %.6f\n", stats->walk_section_ns / 1e9);
+    om_family(sb, "system_monitor_task_walk_rcu_section_max_seconds", "gauge",
+              "Longest RCU read-side section of any task walk since the module was loaded.");
+    sb_printf(sb, "system_monitor_task_walk_rcu_section_max_seconds %.6f\n", stats->walk_max_section_ns / 1e9);
+    om_family(sb, "system_monitor_task_walk_sections", "gauge", "RCU read-side sections of the last task walk.");
+    sb_printf(sb, "system_monitor_task_walk_sections %u\n", stats->walk_sections);
+    om_family(sb, "system_monitor_task_walk_pause_seconds", "gauge", "Time the last task walk slept between sections.");
+    sb_printf(sb, "system_monitor_task_walk_pause_seconds %.6f\n", stats->walk_pause_ns / 1e9);
+
+    om_family(sb, "system_monitor_stats_opens", "counter", "Opens of the statistics files.");
+    sb_printf(sb, "system_monitor_stats_opens_total %lld\n", stats->reads_opens);
+    om_family(sb, "system_monitor_stats_cached_opens", "counter",
+              "Opens served the latest sample's existing rendering.");
+    sb_printf(sb, "system_monitor_stats_cached_opens_total %lld\n", stats->reads_cached);
+    om_family(sb, "system_monitor_stats_throttled_opens", "counter",
+              "Opens served an older rendering because of the render budget.");
+    sb_printf(sb, "system_monitor_stats_throttled_opens_total %lld\n", stats->reads_throttled);
+    om_family(sb, "system_monitor_stats_renders", "counter", "Renderings of the statistics files.");
+    sb_printf(sb, "system_monitor_stats_renders_total %lld\n", stats->reads_renders);
+
+    om_family(sb, "system_monitor_idle", "gauge", "Whether collection is suspended for lack of readers.");
+    sb_printf(sb, "system_monitor_idle %d\n", stats->idle);
+    om_family(sb, "system_monitor_event_subscribers", "gauge", "Open event files.");
+    sb_printf(sb, "system_monitor_event_subscribers %d\n", stats->idle_subscribers);
+    om_family(sb, "system_monitor_idle_periods", "counter", "Times collection was suspended for lack of readers.");
+    sb_printf(sb, "system_monitor_idle_periods_total %u\n", stats->idle_periods);
+
+    om_family(sb, "system_monitor_io_read_bytes", "counter", "Bytes read from storage by all processes.");
+    sb_printf(sb, "system_monitor_io_read_bytes_total %lu\n", stats->read_bytes);
+    om_family(sb, "system_monitor_io_write_bytes", "counter", "Bytes written to storage by all processes.");
+    sb_printf(sb, "system_monitor_io_write_bytes_total %lu\n", stats->write_bytes);
+    om_family(sb, "system_monitor_io_cancelled_write_bytes", "counter",
+              "Bytes whose writeback was cancelled, e.g. by truncation.");
+    sb_printf(sb, "system_monitor_io_cancelled_write_bytes_total %lu\n", stats->cancelled_write_bytes);
+    om_family(sb, "system_monitor_io_syscalls", "counter", "Read and write system calls.");
+    sb_printf(sb, "system_monitor_io_syscalls_total{op=\"read\"} %lu\n", stats->syscr);
+    sb_printf(sb, "system_monitor_io_syscalls_total{op=\"write\"} %lu\n", stats->syscw);
+
+    om_family(sb, "system_monitor_network_receive_bytes", "counter", "Bytes received on all interfaces.");
+    sb_printf(sb, "system_monitor_network_receive_bytes_total %lu\n", stats->rx_bytes);
+    om_family(sb, "system_monitor_network_transmit_bytes", "counter", "Bytes transmitted on all interfaces.");
+    sb_printf(sb, "system_monitor_network_transmit_bytes_total %lu\n", stats->tx_bytes);
+    om_family(sb, "system_monitor_network_receive_packets", "counter", "Packets received on all interfaces.");
+    sb_printf(sb, "system_monitor_network_receive_packets_total %lu\n", stats->rx_packets);
+    om_family(sb, "system_monitor_network_transmit_packets", "counter", "Packets transmitted on all interfaces.");
+    sb_printf(sb, "system_monitor_network_transmit_packets_total %lu\n", stats->tx_packets);
+
+out:
+    sb_printf(sb, "# EOF\n");
+}
+
+/**
+ * snapshot_put - Drops a reference to a snapshot, freeing it on the last one
+ * @snap: Snapshot to release
+ */
+void snapshot_put(struct export_snapshot *snap) {
+    if (snap && --snap->refs == 0) {
+        free(snap);
+    }
+}
+
+/**
+ * export_sample - Reads the module once and publishes a new snapshot
+ * @body: Scratch buffer reused across samples for the OpenMetrics body
+ *
+ * The full HTTP response is built here so that serving a scrape is a plain
+ * write of shared bytes, whatever the number of concurrent scrapers.
+ */
+void export_sample(struct strbuf *body) {
+    struct system_stats stats;
+    char header[256];
+
+    encode_openmetrics(body, read_stats(&stats) == 0 ? &stats : NULL);
+
+    int hlen = snprintf(header, sizeof(header),
+                        "HTTP/1.1 200 OK\r\nContent-Type: " EXPORT_CONTENT_TYPE "\r\nContent-Length: %zu\r\n\r\n",
+                        body->len);
+    struct export_snapshot *snap = malloc(sizeof(*snap) + hlen + body->len);
+    if (!snap) return;
+
+    snap->refs = 1;
+    snap->len = hlen + body->len;
+    memcpy(snap->data, header, hlen);
+    memcpy(snap->data + hlen, body->buf, body->len);
+
+    snapshot_put(export_current);
+    export_current = snap;
+}
+
+/**
+ * export_listen - Creates the listening socket for the exporter
+ * @addr: "unix:/path" for a Unix socket, or "[host:]port" for TCP
+ *
+ * TCP listeners bind to the loopback address unless a host is given.
+ * Returns a non-blocking listening socket or -1 on error.
+ */
+int export_listen(const char *addr) {
+    int fd = -1;
+
+    if (strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+        struct stat st;
+
+        if (strlen(addr + 5) >= sizeof(sun.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", addr + 5);
+            return -1;
+        }
+        strcpy(sun.sun_path, addr + 5);
+        if (stat(sun.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(sun.sun_path);
+        }
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+            perror("Failed to bind exporter socket");
+            goto err;
+        }
+    } else {
+        char host[256] = EXPORT_DEFAULT_HOST;
+        const char *port = addr;
+        const char *colon = strrchr(addr, ':');
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+        struct addrinfo *res;
+        int one = 1;
+
+        if (colon) {
+            snprintf(host, sizeof(host), "%.*s", (int)(colon - addr), addr);
+            port = colon + 1;
+        }
+        if (getaddrinfo(host, port, &hints, &res) != 0) {
+            fprintf(stderr, "Invalid exporter address: %s\n", addr);
+            return -1;
+        }
+
+        fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) < 0) {
+            perror("Failed to bind exporter socket");
+            freeaddrinfo(res);
+            goto err;
+        }
+        freeaddrinfo(res);
+    }
+
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("Failed to listen on exporter socket");
+        goto err;
+    }
+    return fd;
+
+err:
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+/**
+ * client_close - Closes a client connection and frees its slot
+ * @c: Client to close
+ */
+void client_close(struct export_client *c) {
+    close(c->fd);
+    snapshot_put(c->snap);
+    c->fd = -1;
+    c->snap = NULL;
+    c->out = NULL;
+}
+
+/**
+ * client_respond - Parses a complete request and queues the response
+ * @c: Client whose request headers have been fully received
+ * @hdr_len: Length of the request headers including the blank line
+ *
+ * Only "GET /metrics" is served. Any bytes after the headers are kept so a
+ * pipelined request is handled once this response has been written.
+ */
+void client_respond(struct export_client *c, size_t hdr_len) {
+    static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    static const char bad_method[] = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n";
+    char method[8], path[64], version[16];
+
+    c->req[hdr_len - 1] = '\0';
+    if (sscanf(c->req, "%7s %63s %15s", method, path, version) != 3) {
+        c->close_after = 1;
+        c->out = bad_method;
+        c->out_len = sizeof(bad_method) - 1;
+    } else {
+        c->close_after = strcmp(version, "HTTP/1.1") != 0 || strcasestr(c->req, "\nConnection: close") != NULL;
+        if (strcmp(method, "GET") != 0) {
+            c->out = bad_method;
+            c->out_len = sizeof(bad_method) - 1;
+        } else if (strcmp(path, "/metrics") != 0 || !export_current) {
+            c->out = not_found;
+            c->out_len = sizeof(not_found) - 1;
+        } else {
+            c->snap = export_current;
+            c->snap->refs++;
+            c->out = c->snap->data;
+            c->out_len = c->snap->len;
+        }
+    }
+
+    c->out_off = 0;
+    c->req_len -= hdr_len;
+    memmove(c->req, c->req + hdr_len, c->req_len);
+}
+
+/**
+ * client_service - Advances a client by reading its request or writing its response
+ * @c: Client with pending socket events
+ */
+void client_service(struct export_client *c) {
+    while (c->fd >= 0) {
+        if (c->out) {
+            ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) client_close(c);
+                return;
+            }
+            c->out_off += n;
+            if (c->out_off < c->out_len) return;
+
+            snapshot_put(c->snap);
+            c->snap = NULL;
+            c->out = NULL;
+            if (c->close_after) {
+                client_close(c);
+                return;
+            }
+            c->deadline_ms = now_ms() + EXPORT_CLIENT_TIMEOUT_MS;
+        }
+
+        char *end = memmem(c->req, c->req_len, "\r\n\r\n", 4);
+        if (end) {
+            client_respond(c, end - c->req + 4);
+            continue;
+        }
+        if (c->req_len == sizeof(c->req)) {
+            client_close(c);
+            return;
+        }
+
+        ssize_t n = recv(c->fd, c->req + c->req_len, sizeof(c->req) - c->req_len, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            client_close(c);
+            return;
+        }
+        if (n < 0) return;
+        c->req_len += n;
+    }
+}
+
+/**
+ * run_exporter - Serves OpenMetrics scrapes until interrupted
+ * @addr: Listen address, see export_listen()
+ * @interval_ms: Sampling interval
+ *
+ * Single-threaded poll() loop. The module is read and encoded once per
+ * interval; every scrape in between is served from the same snapshot.
+ * Memory is bounded by EXPORT_MAX_CLIENTS: when all slots are busy new
+ * connections wait in the listen backlog, and idle or stalled clients are
+ * dropped after EXPORT_CLIENT_TIMEOUT_MS.
+ */
+int run_exporter(const char *addr, int interval_ms) {
+    struct pollfd pfds[EXPORT_MAX_CLIENTS + 1];
+    int slot_of[EXPORT_MAX_CLIENTS + 1];
+    struct strbuf body = { 0 };
+    int i;
+
+    int lfd = export_listen(addr);
+    if (lfd < 0) return 1;
+
+    for (i = 0; i < EXPORT_MAX_CLIENTS; i++) {
+        export_clients[i].fd = -1;
+    }
+
+    long long next_sample = now_ms();
+    while (running) {
+        long long now = now_ms();
+        if (now >= next_sample) {
+            export_sample(&body);
+            next_sample += interval_ms;
+            if (next_sample <= now) next_sample = now + interval_ms;
+        }
+
+        int nfds = 0, free_slots = 0;
+        long long wake = next_sample;
+        for (i = 0; i < EXPORT_MAX_CLIENTS; i++) {
+            struct export_client *c = &export_clients[i];
+            if (c->fd < 0) {
+                free_slots++;
+                continue;
+            }
+            if (now >= c->deadline_ms) {
+                client_close(c);
+                free_slots++;
+                continue;
+            }
+            if (c->deadline_ms < wake) wake = c->deadline_ms;
+            pfds[nfds] = (struct pollfd){ .fd = c->fd, .events = c->out ? POLLOUT : POLLIN };
+            slot_of[nfds++] = i;
+        }
+        if (free_slots) {
+            pfds[nfds] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+            slot_of[nfds++] = -1;
+        }
+
+        int ready = poll(pfds, nfds, wake > now ? (int)(wake - now) : 0);
+        if (ready <= 0) continue;
+
+        for (i = 0; i < nfds; i++) {
+            if (!pfds[i].revents) continue;
+            if (slot_of[i] >= 0) {
+                client_service(&export_clients[slot_of[i]]);
+                continue;
+            }
+
+            for (int s = 0; s < EXPORT_MAX_CLIENTS; s++) {
+                struct export_client *c = &export_clients[s];
+                if (c->fd >= 0) continue;
+
+                c->fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (c->fd < 0) break;
+                c->req_len = 0;
+                c->close_after = 0;
+                c->deadline_ms = now_ms() + EXPORT_CLIENT_TIMEOUT_MS;
+                client_service(c);
+            }
+        }
+    }
+
+    for (i = 0; i < EXPORT_MAX_CLIENTS; i++) {
+        if (export_clients[i].fd >= 0) client_close(&export_clients[i]);
+    }
+    snapshot_put(export_current);
+    export_current = NULL;
+    free(body.buf);
+    close(lfd);
+    if (strncmp(addr, "unix:", 5) == 0) unlink(addr + 5);
+    return 0;
+}
+
+/**
+ * ring_push - Queues a sample from the collector thread
+ * @ring: Ring to push to
+ * @stats: Sample to copy in
+ *
+ * Never blocks: if the renderer has fallen a full ring behind, the sample
+ * is counted as dropped and discarded. Returns 1 if the sample was queued.
+ */
+int ring_push(struct stats_ring *ring, const struct system_stats *stats) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    atomic_fetch_add_explicit(&ring->produced, 1, memory_order_relaxed);
+    if (head - tail == STATS_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    ring->slots[head % STATS_RING_SIZE] = *stats;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * ring_pop_latest - Takes the newest queued sample on the render thread
+ * @ring: Ring to consume from
+ * @stats: Filled with the newest sample
+ *
+ * Older queued samples are skipped and counted as dropped, so the display
+ * always shows the freshest data however slow the terminal is.
+ * Returns 1 if a sample was taken, 0 if the ring was empty.
+ */
+int ring_pop_latest(struct stats_ring *ring, struct system_stats *stats) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) return 0;
+
+    *stats = ring->slots[(head - 1) % STATS_RING_SIZE];
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+    atomic_fetch_add_explicit(&ring->dropped, head - tail - 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ring->rendered, 1, memory_order_relaxed);
+    return 1;
+}
+
+/**
+ * collector_main - Collector thread: reads and parses samples on a fixed cadence
+ * @arg: Sampling interval in milliseconds, cast to a pointer
+ *
+ * Runs independently of the terminal so a slow redraw never delays sampling.
+ * Each sample is pushed to the ring and the renderer is woken through
+ * collector_wake_fd. The last flight recording travels with every sample
+ * but is only re-read when the kernel reports a new one. On a read error the errno is published in
+ * collector_error and the thread exits.
+ */
+void *collector_main(void *arg) {
+    long interval_ms = (long)(intptr_t)arg;
+    struct system_stats stats;
+    unsigned long long prev_cpu[NR_CPU_MODES] = { 0 };
+    static struct flight_dump flight;
+    unsigned int flight_recordings = UINT_MAX;
+    struct timespec next;
+    uint64_t one = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (running) {
+        if (read_stats(&stats) < 0) {
+            atomic_store(&collector_error, errno ? errno : EIO);
+            write(collector_wake_fd, &one, sizeof(one));
+            break;
+        }
+        cpu_update_shares(&stats, prev_cpu);
+        memcpy(prev_cpu, stats.cpu, sizeof(prev_cpu));
+        // The recording only changes when the kernel freezes a new one
+        if (stats.flight_recordings != flight_recordings) {
+            if (read_flight(&flight)) memset(&flight, 0, sizeof(flight));
+            flight_recordings = stats.flight_recordings;
+        }
+        stats.flight = flight;
+        ring_push(&stats_ring, &stats);
+        write(collector_wake_fd, &one, sizeof(one));
+
+        next.tv_nsec += (interval_ms % 1000) * 1000000;
+        next.tv_sec += interval_ms / 1000 + next.tv_nsec / 1000000000;
+        next.tv_nsec %= 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * run_display - Runs the interactive ncurses display
+ * @interval_ms: Sampling interval of the collector thread
+ *
+ * The calling thread becomes the renderer. It sleeps until the collector
+ * signals a new sample or a key is pressed, then draws only the newest
+ * queued sample.
+ */
+int run_display(int interval_ms) {
+    struct system_stats stats;
+    int have_stats = 0;
+    pthread_t collector;
+
+    collector_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (collector_wake_fd < 0) {
+        perror("Failed to create eventfd");
+        return 1;
+    }
 
     initscr();
     start_color();
     use_default_colors();
     curs_set(0);
     noecho();
+    cbreak();
+    nodelay(stdscr, TRUE);
+    keypad(stdscr, TRUE);
 
     init_pair(1, COLOR_GREEN, -1);
     init_pair(2, COLOR_BLUE, -1);
     init_pair(3, COLOR_YELLOW, -1);
     init_pair(4, COLOR_MAGENTA, -1);
+    init_pair(5, COLOR_CYAN, -1);
+    init_pair(6, COLOR_RED, -1);
+    init_pair(7, COLOR_WHITE, -1);
 
-    struct system_stats stats;
+    if (pthread_create(&collector, NULL, collector_main, (void *)(intptr_t)interval_ms) != 0) {
+        endwin();
+        fprintf(stderr, "Failed to start collector thread\n");
+        return 1;
+    }
 
     while (running) {
-        read_stats(&stats);
-        display_stats(&stats);
-        usleep(500000);
+        struct pollfd pfds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = collector_wake_fd, .events = POLLIN },
+        };
+        uint64_t wakeups;
+        int ch;
+
+        if (poll(pfds, 2, -1) < 0 && errno != EINTR) break;
+
+        while ((ch = getch()) != ERR) {
+            if (ch == 'q') {
+                running = 0;
+                continue;
+            }
+            if (!have_stats) continue;
+            if (ch == 'r') {
+                clearok(stdscr, TRUE);
+            } else if (ch == 't') {
+                current_view = VIEW_TREE;
+            } else if (ch == 'u') {
+                current_view = VIEW_USERS;
+            } else if (ch == 'f') {
+                current_view = VIEW_FLIGHT;
+            } else if (ch == 'p') {
+                current_view = VIEW_PROFILE;
+            } else if (ch == 'm') {
+                current_view = VIEW_SUMMARY;
+            } else if (current_view == VIEW_TREE) {
+                tree_key(&stats, ch);
+            }
+            render(&stats);
+        }
+        if (pfds[1].revents) {
+            read(collector_wake_fd, &wakeups, sizeof(wakeups));
+        }
+        if (atomic_load(&collector_error)) break;
+
+        if (ring_pop_latest(&stats_ring, &stats)) {
+            have_stats = 1;
+            render(&stats);
+        }
     }
 
+    running = 0;
+    pthread_join(collector, NULL);
     endwin();
+    close(collector_wake_fd);
+
+    if (atomic_load(&collector_error)) {
+        errno = atomic_load(&collector_error);
+        perror("Failed to open proc file");
+        return 1;
+    }
     return 0;
 }
+
+/**
+ * usage - Prints command line help
+ * @prog: Program name
+ */
+void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -e, --export ADDR     Run headless and serve OpenMetrics on ADDR\n"
+            "                        (\"unix:/path\" or \"[host:]port\", host defaults to " EXPORT_DEFAULT_HOST ")\n"
+            "  -i, --interval MS     Sampling interval (default %d, %d when exporting)\n"
+            "  -h, --help            Show this help\n",
+            prog, DISPLAY_INTERVAL_MS, EXPORT_INTERVAL_MS);
+}
+
+/**
+ * main - Program entry point
+ *
+ * Parses options, sets up signal handling, and runs either the headless
+ * exporter or the interactive display until interrupted.
+ */
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        { "export", required_argument, NULL, 'e' },
+        { "interval", required_argument, NULL, 'i' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *export_addr = NULL;
+    int interval_ms = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "e:i:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'e':
+            export_addr = optarg;
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            if (interval_ms <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    signal(SIGINT, signal_handler);
+
+    if (export_addr) {
+        signal(SIGTERM, signal_handler);
+        return run_exporter(export_addr, interval_ms ? interval_ms : EXPORT_INTERVAL_MS);
+    }
+
+    return run_display(interval_ms ? interval_ms : DISPLAY_INTERVAL_MS);
+}